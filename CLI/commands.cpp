@@ -175,11 +175,12 @@ int command_device_find(boost::program_options::variables_map& vm)
           "'facade device find' requires at least one filter --uid, --name, or --type")
 
     std::string uid = vm.count("uid") ? vm["uid"].as<std::string>() : "";
-    std::string type = vm.count("video") ? vm["type"].as<std::string>() : "";
+    std::string type = vm.count("type") ? vm["type"].as<std::string>() : "";
     std::string name = vm.count("name") ? vm["name"].as<std::string>() : "";
 
     facade_state *state = nullptr;
-    facade_error_code code = facade_read_state(&state);
+    uint64_t version = 0;
+    facade_error_code code = facade_read_cached_state(&state, &version);
 
     if (state != nullptr)
     {
@@ -195,6 +196,8 @@ int command_device_find(boost::program_options::variables_map& vm)
                 {
                     print_xml(info);
                 }
+
+                info = info->next;
             } while(info != state->devices);
         }
 
@@ -9,6 +9,7 @@
 #define FACADE_H_D557512F84D244B7B3830C04E09468AD
 
 #include <ctype.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -105,6 +106,16 @@ typedef struct facade_device {
     facade_device_data *data;          /*!< Platform-specific handles used by Facade to implement IO operations. */
 } facade_device;
 
+/**
+ * @brief A rectangle of pixels in a video frame
+ */
+typedef struct {
+    uint32_t x;                        /*!< The column of the rectangle's left edge */
+    uint32_t y;                        /*!< The row of the rectangle's top edge */
+    uint32_t width;                    /*!< The width of the rectangle, in pixels */
+    uint32_t height;                   /*!< The height of the rectangle, in pixels */
+} facade_rect;
+
 /**
  * @brief A callback that can be registered when read / write operations are ready on a device.
  */
@@ -176,6 +187,39 @@ facade_error_code facade_on_state_changed(facade_callback callback, void *contex
 facade_error_code facade_dispose_state(facade_state **p);
 
 
+/**
+ * @}
+ *
+ * @defgroup Cached state access
+ * @{
+ */
+
+/**
+ * @brief Read the version of the cached Facade state.
+ * @param[out] version - Changes whenever a device is created, edited or deleted. It is never 0.
+ * @return \c facade_error_none on success.
+ * @return \c facade_error_not_initialized if facade_init() was not called.
+ *
+ * libfacade keeps a copy of the state and marks it stale whenever the state changes, re-reading it
+ * only when it is next used. This reads no state at all, so it is cheap enough to poll. The version may
+ * change without any device changing.
+ */
+facade_error_code facade_state_version(uint64_t *version);
+
+/**
+ * @brief Copy the cached Facade state, unless it has not changed since the version given.
+ * @param[out] p - The state, to be disposed with facade_dispose_state(), or \c NULL if it is still at \p version.
+ * @param[in, out] version - The version of the state the caller holds, or 0 for none. This is updated to the
+ *      version of the state returned.
+ * @return \c facade_error_none on success, whether or not the state changed.
+ * @return \c facade_error_not_initialized if facade_init() was not called.
+ * @return \c facade_error_unknown if the state could not be read.
+ *
+ * Unlike facade_read_state(), this only reaches the system once after each change to the state.
+ * facade_find_device_by_uid() and facade_find_device_by_name() look devices up in the same cache.
+ */
+facade_error_code facade_read_cached_state(facade_state **p, uint64_t *version);
+
 /**
  * @}
  *
@@ -299,6 +343,36 @@ facade_error_code facade_read_callback(facade_device *p, facade_callback callbac
  */
 facade_error_code facade_read_frame(facade_device *p, void **buffer, size_t *buffer_size);
 
+/**
+ * @brief Borrow the newest frame in the device's own buffer, without copying it.
+ * @param[in] p - The video device.
+ * @param[out] buffer - The BGRA32 pixels of the frame, valid until facade_read_release().
+ * @param[out] stride - The number of bytes between the starts of consecutive rows.
+ * @param[out] width - The width of the frame, in pixels.
+ * @param[out] height - The height of the frame, in pixels.
+ * @return \c facade_error_none on success.
+ * @return \c facade_error_reader_not_ready if the device's output stream is empty.
+ * @return \c facade_error_invalid_state if a frame is already acquired and not yet released.
+ * @return \c facade_error_unknown if there was another issue reading the output stream.
+ *
+ * The writer cannot reuse the buffer while it is acquired, so release it as soon as possible. The
+ * frame's size is returned because the device may have been resized since it was written.
+ */
+facade_error_code facade_read_acquire(facade_device *p,
+                                      void **buffer,
+                                      size_t *stride,
+                                      uint32_t *width,
+                                      uint32_t *height);
+
+/**
+ * @brief Give back a frame borrowed with facade_read_acquire().
+ * @param[in] p - The video device.
+ * @param[in] buffer - The buffer returned by facade_read_acquire().
+ * @return \c facade_error_none on success.
+ * @return \c facade_error_invalid_input if \p buffer is not the acquired frame.
+ */
+facade_error_code facade_read_release(facade_device *p, void *buffer);
+
 /**
  * @brief Close the device for reads.
  * @param[in] p - The device to close.
@@ -334,6 +408,61 @@ facade_error_code facade_write_callback(facade_device *p, facade_callback callba
  */
 facade_error_code facade_write_frame(facade_device *p, void *buffer, size_t buffer_size);
 
+/**
+ * @brief Write a frame that differs from the previous frame written only within some rectangles.
+ * @param[in] p - The video device.
+ * @param[in] buffer - The BGRA32 pixel buffer holding the whole frame, as for facade_write_frame().
+ * @param[in] buffer_size - The size of the pixel buffer.
+ * @param[in] rects - The rectangles that changed since the previous frame written to the device.
+ * @param[in] rect_count - The number of rectangles in \p rects, which may be 0 if nothing changed.
+ * @return \c facade_error_none on success.
+ * @return \c facade_error_invalid_input if the pixel buffer size is not the correct byte size (4 * width * height),
+ *      or a rectangle does not fit within the frame.
+ * @return \c facade_error_writer_not_ready if the device's input stream is at full capacity.
+ * @return \c facade_error_unknown if there was another issue writing to the input stream.
+ *
+ * This lets libfacade copy only the pixels that changed, where the device allows it. The first frame
+ * written after facade_write_open(), after the device is resized, or after a frame written some other way
+ * is always copied whole.
+ */
+facade_error_code facade_write_damaged_frame(facade_device *p,
+                                             void *buffer,
+                                             size_t buffer_size,
+                                             const facade_rect *rects,
+                                             size_t rect_count);
+
+/**
+ * @brief Borrow the device's next buffer to draw a frame into, instead of copying one in.
+ * @param[in] p - The video device.
+ * @param[out] buffer - The BGRA32 pixels to fill, with room for \p height rows of \p stride bytes.
+ * @param[out] stride - The number of bytes between the starts of consecutive rows.
+ * @param[out] width - The width of the frame to draw, in pixels, which can lag behind the device's.
+ * @param[out] height - The height of the frame to draw, in pixels.
+ * @return \c facade_error_none on success.
+ * @return \c facade_error_writer_not_ready if the device's input stream is at full capacity.
+ * @return \c facade_error_invalid_state if a buffer is already acquired and not yet committed.
+ * @return \c facade_error_unknown if there was another issue writing to the input stream.
+ */
+facade_error_code facade_write_acquire(facade_device *p,
+                                       void **buffer,
+                                       size_t *stride,
+                                       uint32_t *width,
+                                       uint32_t *height);
+
+/**
+ * @brief Publish a buffer filled after facade_write_acquire().
+ * @param[in] p - The video device.
+ * @param[in] buffer - The buffer returned by facade_write_acquire().
+ * @param[in] timestamp - The frame's presentation time in nanoseconds on the host's monotonic clock,
+ * or 0 to stamp it now.
+ * @return \c facade_error_none on success.
+ * @return \c facade_error_invalid_input if \p buffer is not the acquired buffer.
+ * @return \c facade_error_invalid_state if the device was resized since, in which case the frame is
+ * dropped.
+ * @return \c facade_error_unknown if there was another issue writing to the input stream.
+ */
+facade_error_code facade_write_commit(facade_device *p, void *buffer, uint64_t timestamp);
+
 /**
  * @brief Close the device for writes.
  * @param[in] p - The device to close.
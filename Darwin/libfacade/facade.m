@@ -10,6 +10,8 @@
 #import <CoreMedia/CoreMedia.h>
 #import <CoreMediaIO/CMIOHardware.h>
 #import <os/log.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 char *FACADE_MODEL = "Facade";
 int FACADE_MODEL_LENGTH = 6;
@@ -47,6 +49,24 @@ NSString *kMagicValue = @"Facade by Paal Maxima";
 facade_callback state_changed_callback = nil;
 void *state_changed_context = nil;
 CMIOObjectPropertyListenerBlock state_changed_block = nil;
+CMIOObjectPropertyListenerBlock devices_changed_block = nil;
+
+/** A Facade device found on the system, remembered so lookups need not enumerate them again. */
+typedef struct
+{
+    CMIOObjectID cmio_id;
+    char *uid;
+    char *name;
+} cached_device;
+
+/** Bumped whenever the state or the system's devices change, which marks the caches stale. */
+atomic_ullong state_version = 1;
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+facade_state *cached_state = nil;
+uint64_t cached_state_version = 0;
+cached_device *cached_devices = nil;
+UInt32 cached_device_count = 0;
+uint64_t cached_devices_version = 0;
 
 dispatch_queue_t listener_queue;
 
@@ -62,11 +82,13 @@ struct facade_device_data
     facade_callback read_callback;
     void *read_context;
     void *read_frame;
+    CMSampleBufferRef read_sample_buffer;
     facade_callback write_callback;
     void *write_context;
     CVPixelBufferPoolRef write_buffer_pool;
     CFDictionaryRef write_buffer_aux_attributes;
     CFMutableArrayRef write_sample_buffers;
+    CVPixelBufferRef write_pixel_buffer;
     facade_callback changed_callback;
     void *changed_context;
     CMIOObjectPropertyListenerBlock changed_block;
@@ -410,8 +432,101 @@ facade_device *read_device(CMIOObjectID device_id)
     return device;
 }
 
+/** Enumerate the Facade devices again if anything changed since they were read. */
+static void refresh_cached_devices(void)
+{
+    const uint64_t version = atomic_load(&state_version);
+
+    if (cached_devices != nil && cached_devices_version == version)
+        return;
+
+    for (UInt32 i = 0; i < cached_device_count; i++)
+    {
+        free(cached_devices[i].uid);
+        free(cached_devices[i].name);
+    }
+    free(cached_devices);
+
+    CMIOObjectID *device_ids = nil;
+    UInt32 device_count = 0;
+    list_devices(&device_ids, &device_count);
+
+    cached_devices = calloc(device_count + 1, sizeof(cached_device));
+    cached_device_count = 0;
+
+    for (UInt32 i = 0; i < device_count; i++)
+    {
+        if (!read_magic_value(device_ids[i]))
+            continue;
+
+        cached_device *device = &cached_devices[cached_device_count++];
+        device->cmio_id = device_ids[i];
+        read_uid(device_ids[i], &device->uid);
+        read_name(device_ids[i], &device->name);
+    }
+
+    free(device_ids);
+    cached_devices_version = version;
+}
+
+/** Find a Facade device by its UID or, if uid is nil, its name. */
+static CMIOObjectID find_cached_device(const char *uid, const char *name)
+{
+    CMIOObjectID device_id = kCMIOObjectUnknown;
+
+    pthread_mutex_lock(&cache_mutex);
+    refresh_cached_devices();
+
+    for (UInt32 i = 0; i < cached_device_count && device_id == kCMIOObjectUnknown; i++)
+    {
+        const char *key = uid != nil ? cached_devices[i].uid : cached_devices[i].name;
+
+        if (key != nil && strcmp(key, uid != nil ? uid : name) == 0)
+            device_id = cached_devices[i].cmio_id;
+    }
+
+    pthread_mutex_unlock(&cache_mutex);
+
+    return device_id;
+}
+
+static facade_state *copy_state(const facade_state *state)
+{
+    facade_state *copy = calloc(1, sizeof(facade_state));
+    copy->api_version = state->api_version;
+
+    facade_device_info *info = state->devices;
+    facade_device_info *last = nil;
+
+    if (info == nil)
+        return copy;
+
+    do
+    {
+        facade_device_info *info_copy = malloc(sizeof(facade_device_info));
+        memcpy(info_copy, info, sizeof(facade_device_info));
+        info_copy->uid = info->uid != nil ? strdup(info->uid) : nil;
+        info_copy->name = info->name != nil ? strdup(info->name) : nil;
+
+        // Keep the original's order in the circular list
+        if (last == nil)
+            copy->devices = info_copy;
+        else
+            last->next = info_copy;
+
+        info_copy->next = copy->devices;
+        last = info_copy;
+        info = info->next;
+    }
+    while (info != nil && info != state->devices);
+
+    return copy;
+}
+
 void on_state_changed(void)
 {
+    atomic_fetch_add(&state_version, 1);
+
     if (state_changed_callback)
         state_changed_callback(state_changed_context);
 }
@@ -447,6 +562,14 @@ facade_error_code facade_init(void)
     CMIOObjectAddPropertyListenerBlock(
         kPlugInID, &kStateProperty, listener_queue, state_changed_block);
 
+    // Devices appear and disappear some time after the state that declares them changes
+    devices_changed_block =
+        ^(UInt32 inClientDataSize, const CMIOObjectPropertyAddress *properties) {
+            atomic_fetch_add(&state_version, 1);
+        };
+    CMIOObjectAddPropertyListenerBlock(
+        kCMIOObjectSystemObject, &kDeviceIDsProperty, listener_queue, devices_changed_block);
+
     return result == kCMIOHardwareNoError && kPlugInID != kCMIOObjectUnknown
                ? facade_error_none
                : facade_error_not_installed;
@@ -661,6 +784,8 @@ facade_error_code facade_write_state(facade_state *state)
 
     if (result != kCMIOHardwareNoError)
         os_log_error(logger, "Failed to write state (OSStatus %i)", result);
+    else
+        atomic_fetch_add(&state_version, 1);
 
     return result == kCMIOHardwareNoError ? facade_error_none : facade_error_unknown;
 }
@@ -673,6 +798,62 @@ facade_error_code facade_on_state_changed(facade_callback callback, void *contex
     return facade_error_none;
 }
 
+facade_error_code facade_state_version(uint64_t *version)
+{
+    if (kPlugInID == 0)
+        return facade_error_not_initialized;
+
+    *version = atomic_load(&state_version);
+
+    return facade_error_none;
+}
+
+facade_error_code facade_read_cached_state(facade_state **state, uint64_t *version)
+{
+    *state = nil;
+
+    if (kPlugInID == 0)
+        return facade_error_not_initialized;
+
+    facade_error_code error = facade_error_none;
+
+    pthread_mutex_lock(&cache_mutex);
+
+    const uint64_t current = atomic_load(&state_version);
+
+    if (cached_state == nil || cached_state_version != current)
+    {
+        facade_state *fresh = nil;
+        error = facade_read_state(&fresh);
+
+        if (error == facade_error_none && fresh != nil)
+        {
+            if (cached_state != nil)
+                facade_dispose_state(&cached_state);
+
+            cached_state = fresh;
+            cached_state_version = current;
+        }
+        else if (fresh != nil)
+        {
+            facade_dispose_state(&fresh);
+        }
+
+        if (error == facade_error_none && cached_state == nil)
+            error = facade_error_unknown;
+    }
+
+    if (error == facade_error_none && *version != cached_state_version)
+    {
+        *state = copy_state(cached_state);
+        *version = cached_state_version;
+    }
+
+    pthread_mutex_unlock(&cache_mutex);
+
+    return error;
+}
+
 facade_error_code facade_dispose_state(facade_state **state)
 {
     facade_device_info *device_info = (*state)->devices;
@@ -718,58 +899,18 @@ facade_error_code facade_list_devices(facade_device **list)
 
 facade_error_code facade_find_device_by_uid(const char *uid, facade_device **device)
 {
-    CMIOObjectID *device_ids = nil;
-    UInt32 device_count = 0;
-    list_devices(&device_ids, &device_count);
-
-    *device = nil;
-
-    for (UInt32 i = 0; i < device_count && *device == nil; i++)
-    {
-        if (!read_magic_value(device_ids[i]))
-            continue;
-
-        char *device_uid = nil;
-        read_uid(device_ids[i], &device_uid);
+    const CMIOObjectID device_id = find_cached_device(uid, nil);
 
-        int match = strcmp(device_uid, uid) == 0;
-
-        free(device_uid);
-
-        if (match)
-            *device = read_device(device_ids[i]);
-    }
-
-    free(device_ids);
+    *device = device_id != kCMIOObjectUnknown ? read_device(device_id) : nil;
 
     return *device != nil ? facade_error_none : facade_error_not_found;
 }
 
 facade_error_code facade_find_device_by_name(const char *name, facade_device **device)
 {
-    CMIOObjectID *device_ids = nil;
-    UInt32 device_count = 0;
-    list_devices(&device_ids, &device_count);
+    const CMIOObjectID device_id = find_cached_device(nil, name);
 
-    *device = nil;
-
-    for (UInt32 i = 0; i < device_count && *device == nil; i++)
-    {
-        if (!read_magic_value(device_ids[i]))
-            continue;
-
-        char *device_name = nil;
-        read_name(device_ids[i], &device_name);
-
-        int match = strcmp(device_name, name) == 0;
-
-        free(device_name);
-
-        if (match)
-            *device = read_device(device_ids[i]);
-    }
-
-    free(device_ids);
+    *device = device_id != kCMIOObjectUnknown ? read_device(device_id) : nil;
 
     return *device != nil ? facade_error_none : facade_error_not_found;
 }
@@ -1060,8 +1201,66 @@ facade_error_code facade_read_frame(facade_device *device, void **buffer, size_t
     return facade_error_none;
 }
 
+facade_error_code facade_read_acquire(facade_device *device,
+                                      void **buffer,
+                                      size_t *stride,
+                                      uint32_t *width,
+                                      uint32_t *height)
+{
+    if (device->data->read_queue == nil)
+        return facade_error_reader_not_ready;
+    if (device->data->read_sample_buffer != nil)
+    {
+        os_log_error(logger, "facade_read_acquire %s - A frame is already acquired.", device->uid);
+        return facade_error_invalid_state;
+    }
+
+    CMSampleBufferRef sample_buffer =
+        (CMSampleBufferRef)CMSimpleQueueDequeue(device->data->read_queue);
+
+    if (sample_buffer == nil)
+        return facade_error_reader_not_ready;
+
+    CVImageBufferRef image_buffer = CMSampleBufferGetImageBuffer(sample_buffer);
+    CVPixelBufferLockBaseAddress(image_buffer, kCVPixelBufferLock_ReadOnly);
+
+    device->data->read_sample_buffer = sample_buffer;
+    *buffer = CVPixelBufferGetBaseAddress(image_buffer);
+    *stride = CVPixelBufferGetBytesPerRow(image_buffer);
+    *width = (uint32_t)CVPixelBufferGetWidth(image_buffer);
+    *height = (uint32_t)CVPixelBufferGetHeight(image_buffer);
+
+    return facade_error_none;
+}
+
+facade_error_code facade_read_release(facade_device *device, void *buffer)
+{
+    CMSampleBufferRef sample_buffer = device->data->read_sample_buffer;
+    CVImageBufferRef image_buffer =
+        sample_buffer != nil ? CMSampleBufferGetImageBuffer(sample_buffer) : nil;
+
+    if (image_buffer == nil || CVPixelBufferGetBaseAddress(image_buffer) != buffer)
+    {
+        os_log_error(logger, "facade_read_release %s - The buffer was not acquired.", device->uid);
+        return facade_error_invalid_input;
+    }
+
+    CVPixelBufferUnlockBaseAddress(image_buffer, kCVPixelBufferLock_ReadOnly);
+    CFRelease(sample_buffer);
+    device->data->read_sample_buffer = nil;
+
+    return facade_error_none;
+}
+
 facade_error_code facade_read_close(facade_device *device)
 {
+    if (device->data->read_sample_buffer != nil)
+    {
+        CVImageBufferRef image_buffer =
+            CMSampleBufferGetImageBuffer(device->data->read_sample_buffer);
+        facade_read_release(device, CVPixelBufferGetBaseAddress(image_buffer));
+    }
+
     OSStatus status = CMIODeviceStopStream(device->data->cmio_id, device->data->streams[0]);
 
     if (device->data->read_queue != nil)
@@ -1135,39 +1334,129 @@ facade_error_code facade_write_frame(facade_device *device, void *buffer, size_t
                      (size_t)BYTES_PER_PIXEL * device->width * device->height);
         return facade_error_invalid_input;
     }
+
+    void *pixels;
+    size_t stride;
+    uint32_t width;
+    uint32_t height;
+    facade_error_code code = facade_write_acquire(device, &pixels, &stride, &width, &height);
+
+    if (code != facade_error_none)
+        return code;
+
+    // Pool buffers may pad their rows, and may not have caught up with a resize yet
+    size_t row_size = (size_t)BYTES_PER_PIXEL * device->width;
+    size_t copy_size = (size_t)BYTES_PER_PIXEL * MIN(width, device->width);
+    for (size_t row = 0; row < MIN(height, device->height); row++)
+        memcpy((char *)pixels + row * stride, (char *)buffer + row * row_size, copy_size);
+
+    return facade_write_commit(device, pixels, 0);
+}
+
+facade_error_code facade_write_damaged_frame(facade_device *device,
+                                             void *buffer,
+                                             size_t buffer_size,
+                                             const facade_rect *rects,
+                                             size_t rect_count)
+{
+    for (size_t i = 0; i < rect_count; i++)
+    {
+        const facade_rect *rect = &rects[i];
+
+        if (rect->x > device->width || rect->width > device->width - rect->x ||
+            rect->y > device->height || rect->height > device->height - rect->y)
+        {
+            os_log_error(logger,
+                         "facade_write_damaged_frame %s - Rectangle %ux%u at (%u, %u) is outside "
+                         "the frame.",
+                         device->uid,
+                         rect->width,
+                         rect->height,
+                         rect->x,
+                         rect->y);
+            return facade_error_invalid_input;
+        }
+    }
+
+    // Pooled pixel buffers come back holding no particular frame, so each is filled whole
+    return facade_write_frame(device, buffer, buffer_size);
+}
+
+facade_error_code facade_write_acquire(facade_device *device,
+                                       void **buffer,
+                                       size_t *stride,
+                                       uint32_t *width,
+                                       uint32_t *height)
+{
+    if (device->data->write_queue == nil)
+    {
+        os_log_error(
+            logger, "facade_write_acquire %s - Output stream was not opened.", device->uid);
+        return facade_error_writer_not_ready;
+    }
+    if (device->data->write_pixel_buffer != nil)
+    {
+        os_log_error(
+            logger, "facade_write_acquire %s - A buffer is already acquired.", device->uid);
+        return facade_error_invalid_state;
+    }
     if (device->data->write_buffer_pool == nil)
     {
 #if DEBUG
-        os_log_debug(logger, "facade_write_frame %s - Allocating write buffer pool", device->uid);
+        os_log_debug(logger, "facade_write_acquire %s - Allocating write buffer pool", device->uid);
 #endif
         create_write_buffer_pool(device);
     }
 
-    OSStatus status = kCMIOHardwareNoError;
-
-    CMSampleTimingInfo timingInfo = {};
-    timingInfo.presentationTimeStamp = CMClockGetTime(CMClockGetHostTimeClock());
-    CMSampleBufferRef sample_buffer;
     CVPixelBufferRef pixel_buffer;
     CVReturn success = CVPixelBufferPoolCreatePixelBufferWithAuxAttributes(
         kCFAllocatorDefault,
         device->data->write_buffer_pool,
         device->data->write_buffer_aux_attributes,
         &pixel_buffer);
+
+    if (success == kCVReturnWouldExceedAllocationThreshold)
+        return facade_error_writer_not_ready;
     if (success != kCVReturnSuccess)
     {
         os_log_error(logger,
-                     "facade_write_frame %s - Failed to allocate pixel buffer. (OSStatus %i)",
+                     "facade_write_acquire %s - Failed to allocate pixel buffer. (OSStatus %i)",
                      device->uid,
                      success);
         return facade_error_unknown;
     }
 
     CVPixelBufferLockBaseAddress(pixel_buffer, 0);
-    memcpy(CVPixelBufferGetBaseAddress(pixel_buffer),
-           buffer,
-           (size_t)BYTES_PER_PIXEL * device->width * device->height);
+
+    device->data->write_pixel_buffer = pixel_buffer;
+    *buffer = CVPixelBufferGetBaseAddress(pixel_buffer);
+    *stride = CVPixelBufferGetBytesPerRow(pixel_buffer);
+    *width = (uint32_t)CVPixelBufferGetWidth(pixel_buffer);
+    *height = (uint32_t)CVPixelBufferGetHeight(pixel_buffer);
+
+    return facade_error_none;
+}
+
+facade_error_code facade_write_commit(facade_device *device, void *buffer, uint64_t timestamp)
+{
+    CVPixelBufferRef pixel_buffer = device->data->write_pixel_buffer;
+
+    if (pixel_buffer == nil || CVPixelBufferGetBaseAddress(pixel_buffer) != buffer)
+    {
+        os_log_error(logger, "facade_write_commit %s - The buffer was not acquired.", device->uid);
+        return facade_error_invalid_input;
+    }
+
     CVPixelBufferUnlockBaseAddress(pixel_buffer, 0);
+    device->data->write_pixel_buffer = nil;
+
+    OSStatus status = kCMIOHardwareNoError;
+
+    CMSampleTimingInfo timingInfo = {};
+    timingInfo.presentationTimeStamp = timestamp != 0
+                                           ? CMTimeMake((int64_t)timestamp, NSEC_PER_SEC)
+                                           : CMClockGetTime(CMClockGetHostTimeClock());
+    CMSampleBufferRef sample_buffer = nil;
 
     status = CMSampleBufferCreateForImageBuffer(kCFAllocatorDefault,
                                                 pixel_buffer,
@@ -1180,10 +1469,9 @@ facade_error_code facade_write_frame(facade_device *device, void *buffer, size_t
     if (status != kCMBlockBufferNoErr)
     {
         os_log_error(logger,
-                     "facade_write_frame %s - Failed to create sample buffer. (OSStatus %i)",
+                     "facade_write_commit %s - Failed to create sample buffer. (OSStatus %i)",
                      device->uid,
                      status);
-        CFRelease(sample_buffer);
         CVPixelBufferRelease(pixel_buffer);
 
         return facade_error_unknown;
@@ -1194,7 +1482,7 @@ facade_error_code facade_write_frame(facade_device *device, void *buffer, size_t
     if (status != kCMBlockBufferNoErr)
     {
         os_log_error(logger,
-                     "facade_write_frame %s - Failed to queue frame. (OSStatus %i)",
+                     "facade_write_commit %s - Failed to queue frame. (OSStatus %i)",
                      device->uid,
                      status);
     }
@@ -1206,6 +1494,13 @@ facade_error_code facade_write_frame(facade_device *device, void *buffer, size_t
 
 facade_error_code facade_write_close(facade_device *device)
 {
+    if (device->data->write_pixel_buffer != nil)
+    {
+        CVPixelBufferUnlockBaseAddress(device->data->write_pixel_buffer, 0);
+        CVPixelBufferRelease(device->data->write_pixel_buffer);
+        device->data->write_pixel_buffer = nil;
+    }
+
     OSStatus status = CMIODeviceStopStream(device->data->cmio_id, device->data->streams[1]);
 
     if (device->data->write_queue != nil)
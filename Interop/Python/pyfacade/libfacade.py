@@ -16,4 +16,9 @@ os.environ['DYLD_LIBRARY_PATH'] = f"{LIBFACADE_LIB_DIR}" \
 ffi = FFI()
 ffi.cdef(facade_h)
 
-libfacade = ffi.dlopen('facade')
+if sys.platform.startswith('linux'):
+    # The dynamic loader reads LD_LIBRARY_PATH once at startup, so load libfacade.so by path instead
+    LIBFACADE_SO = 'libfacade.so'
+    libfacade = ffi.dlopen(os.path.join(LIBFACADE_LIB_DIR, LIBFACADE_SO) if LIBFACADE_LIB_DIR else LIBFACADE_SO)
+else:
+    libfacade = ffi.dlopen('facade')
@@ -42,12 +42,20 @@ typedef struct facade_device {
     uint32_t frame_rate;               
     facade_device_data *data;          
 } facade_device;
+typedef struct {
+    uint32_t x;                        
+    uint32_t y;                        
+    uint32_t width;                    
+    uint32_t height;                   
+} facade_rect;
 typedef void (*facade_callback)(void *context);
 facade_error_code facade_init(void);
 facade_error_code facade_read_state(facade_state **p);
 facade_error_code facade_write_state(facade_state *p);
 facade_error_code facade_on_state_changed(facade_callback callback, void *context);
 facade_error_code facade_dispose_state(facade_state **p);
+facade_error_code facade_state_version(uint64_t *version);
+facade_error_code facade_read_cached_state(facade_state **p, uint64_t *version);
 facade_error_code facade_list_devices(facade_device **p);
 facade_error_code facade_find_device_by_uid(char const *uid, facade_device **p);
 facade_error_code facade_find_device_by_name(char const *name, facade_device **p);
@@ -59,10 +67,27 @@ facade_error_code facade_on_device_changed(facade_device *, facade_callback call
 facade_error_code facade_read_open(facade_device *p);
 facade_error_code facade_read_callback(facade_device *p, facade_callback callback, void *context);
 facade_error_code facade_read_frame(facade_device *p, void **buffer, size_t *buffer_size);
+facade_error_code facade_read_acquire(facade_device *p,
+                                      void **buffer,
+                                      size_t *stride,
+                                      uint32_t *width,
+                                      uint32_t *height);
+facade_error_code facade_read_release(facade_device *p, void *buffer);
 facade_error_code facade_read_close(facade_device *p);
 facade_error_code facade_write_open(facade_device *);
 facade_error_code facade_write_callback(facade_device *p, facade_callback callback, void *context);
 facade_error_code facade_write_frame(facade_device *p, void *buffer, size_t buffer_size);
+facade_error_code facade_write_damaged_frame(facade_device *p,
+                                             void *buffer,
+                                             size_t buffer_size,
+                                             const facade_rect *rects,
+                                             size_t rect_count);
+facade_error_code facade_write_acquire(facade_device *p,
+                                       void **buffer,
+                                       size_t *stride,
+                                       uint32_t *width,
+                                       uint32_t *height);
+facade_error_code facade_write_commit(facade_device *p, void *buffer, uint64_t timestamp);
 facade_error_code facade_write_close(facade_device *p);
 void free(void *);
 """
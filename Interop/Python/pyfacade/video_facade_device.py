@@ -1,4 +1,7 @@
-from typing import Optional
+import threading
+from typing import Iterator, Optional, Union
+
+import numpy as np
 
 from .facade_device import FacadeDevice
 from .facade_device_type import FacadeDeviceType
@@ -12,8 +15,11 @@ class VideoFacadeDevice(FacadeDevice):
     frames in a 8-bit/channel RGBA pixel format.
     """
 
+    # The frame read_frame returned as a view, which stays acquired until the next read
+    _acquired_frame = None
+
     def __str__(self) -> str:
-        return f"FacadeDevice{{uid={self.uid} width={self.width}, height={self.width}, frame_rate={self.frame_rate}}}"
+        return f"FacadeDevice{{uid={self.uid} width={self.width}, height={self.height}, frame_rate={self.frame_rate}}}"
 
     @property
     def type(self) -> FacadeDeviceType.video:
@@ -51,44 +57,112 @@ class VideoFacadeDevice(FacadeDevice):
 
         return self.width * self.height * 4
 
-    def read_frame(self, buffer: Optional[bytearray]) -> Optional[ffi.buffer]:
+    def read_frame(self, out: Optional[Union[np.ndarray, bytearray]] = None) -> Optional[np.ndarray]:
         """
         Reads the next video frame.
 
-        :param buffer: A buffer, of size :attr:`frame_byte_size`, to copy the video frame into. This can
-            be used to optimize memory consumed by this operation.
-        :return: A buffer containing the video frame pixels, if the device had a frame buffered. Otherwise, ``None``.
+        :param out: An array of the frame's shape, or a buffer of at least as many bytes as the frame, to copy the
+            video frame into. Without it, no copy is made.
+        :return: The video frame pixels as a ``uint8`` array of shape (height, width, 4), if the device had a frame
+            buffered. Otherwise, ``None``. The frame keeps the size it was written at, which can lag behind a resize of
+            the device. Without ``out``, the array is a view over the device's own buffer, which is only valid until
+            the next read.
+        """
+
+        self._release_frame()
+
+        pixels = ffi.new('void **')
+        stride = ffi.new('size_t *')
+        width = ffi.new('uint32_t *')
+        height = ffi.new('uint32_t *')
+        code = libfacade.facade_read_acquire(self._pointer, pixels, stride, width, height)
+
+        if code == FacadeErrorCode.reader_not_ready:
+            return None
+        if code != FacadeErrorCode.none:
+            raise FacadeError('facade_read_acquire', code)
+
+        # Rows may be padded past the last pixel
+        frame = np.ndarray(shape=(height[0], width[0], 4),
+                           dtype=np.uint8,
+                           buffer=ffi.buffer(pixels[0], stride[0] * height[0]),
+                           strides=(stride[0], 4, 1))
+
+        if out is None:
+            self._acquired_frame = pixels[0]
+            return frame
+
+        try:
+            if not isinstance(out, np.ndarray):
+                if len(out) < frame.nbytes:
+                    raise ValueError(f"buffer is too small (minimum size is {frame.nbytes})")
+                out = np.frombuffer(out, dtype=np.uint8, count=frame.nbytes).reshape(frame.shape)
+
+            np.copyto(out, frame)
+        finally:
+            libfacade.facade_read_release(self._pointer, pixels[0])
+
+        return out
+
+    def close(self) -> None:
+        # Closing gives back an acquired frame
+        self._acquired_frame = None
+        super().close()
+
+    def _release_frame(self):
+        if self._acquired_frame is not None:
+            libfacade.facade_read_release(self._pointer, self._acquired_frame)
+            self._acquired_frame = None
+
+    def frames(self,
+               out: Optional[Union[np.ndarray, bytearray]] = None,
+               timeout: Optional[float] = None) -> Iterator[np.ndarray]:
         """
+        Iterates over video frames as they arrive, waiting for each.
 
-        if buffer is None:
-            buffer_size = self.frame_byte_size
-            native_buffer = ffi.new(f'uint8_t[{buffer_size}]')
-        else:
-            if len(buffer) < self.frame_byte_size:
-                raise ValueError(f"buffer is too small (minimum size is {self.frame_byte_size})")
-            buffer_size = len(buffer)
-            native_buffer = ffi.from_buffer(cdecl='uint8_t *', python_buffer=buffer)
+        Each frame is read into ``out``, or else viewed in the device's own buffer, so a frame is only valid until
+        the next is yielded. Copy it to keep it.
 
-        code = libfacade.facade_read(self._pointer, native_buffer, buffer_size)
+        :note: You must :func:`open` this device in read mode. This replaces the device's read callback while
+            iterating.
+        :param out: The buffer to copy each frame into, as for :func:`read_frame`.
+        :param timeout: The seconds to wait for a frame before the iteration stops, or ``None`` to wait forever.
+        :return: An iterator over the frames, each as returned by :func:`read_frame`.
+        """
 
-        if code not in (FacadeErrorCode.none, FacadeErrorCode.reader_not_ready):
-            raise FacadeError('facade_read_frame', code)
+        ready = threading.Event()
+        self.read_callback(ready.set)
 
-        return ffi.buffer(native_buffer) if code == FacadeErrorCode.none else None
+        try:
+            while True:
+                # Cleared before reading, so a frame that arrives in between is not missed
+                ready.clear()
+                frame = self.read_frame(out)
 
-    def write_frame(self, buffer: Optional[bytearray]):
+                if frame is not None:
+                    yield frame
+                elif not ready.wait(timeout):
+                    return
+        finally:
+            self.read_callback(None)
+
+    def write_frame(self, buffer: Union[np.ndarray, bytes, bytearray]):
         """
         Writes the next video frame.
 
-        :param buffer: A buffer, of size :attr:`frame_byte_size`, to copy the video frame from.
+        :param buffer: The video frame, as a C-contiguous ``uint8`` array of shape (:attr:`height`, :attr:`width`,
+            4) or a buffer of :attr:`frame_byte_size` bytes. It is copied into the device without conversion.
         :raises FacadeError: If the device is not ready for the next frame.
         """
 
-        buffer_size = self.width * self.height * 4
-        if len(buffer) < buffer_size:
+        if isinstance(buffer, np.ndarray) and not buffer.flags.c_contiguous:
+            raise ValueError("frame must be C-contiguous")
+
+        buffer_size = memoryview(buffer).nbytes
+        if buffer_size < self.frame_byte_size:
             raise ValueError("buffer is of wrong size")
 
-        code = libfacade.facade_write_frame(self._pointer, ffi.from_buffer('void *', buffer), len(buffer))
+        code = libfacade.facade_write_frame(self._pointer, ffi.from_buffer(buffer), buffer_size)
 
         if code != FacadeErrorCode.none:
             raise FacadeError('facade_write_frame', code)
@@ -11,7 +11,7 @@ setup(
         "Programming Language :: Python :: 3",
     ],
     include_package_data=True,
-    install_requires=["cffi>=1.15.1"],
+    install_requires=["cffi>=1.15.1", "numpy>=1.21"],
     packages=['pyfacade'],
     package_dir={'pyfacade': 'pyfacade'},
     setup_requires=["cffi>=1.15.1"],
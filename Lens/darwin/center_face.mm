@@ -9,7 +9,7 @@
 
 namespace fs = std::filesystem;
 
-namespace lens
+namespace lens::coreml
 {
 
 const size_t EXPECTED_ROWS = 480;
@@ -116,7 +116,7 @@ void center_face_impl::run(const cv::Mat &image,
     [image_data release];
 }
 
-std::unique_ptr<center_face> center_face::build(const fs::path &model_dir)
+std::unique_ptr<center_face> build_center_face(const fs::path &model_dir)
 {
     fs::path model_path = model_dir / fs::path("CenterFace.mlmodel");
     auto compiled_path = model::compile(model_path);
@@ -128,4 +128,4 @@ std::unique_ptr<center_face> center_face::build(const fs::path &model_dir)
     return std::unique_ptr<center_face>(new center_face_impl(model));
 }
 
-} // namespace lens
+} // namespace lens::coreml
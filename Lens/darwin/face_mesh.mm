@@ -9,7 +9,7 @@
 
 namespace fs = std::filesystem;
 
-namespace lens
+namespace lens::coreml
 {
 
 class face_mesh_impl : public face_mesh
@@ -85,7 +85,7 @@ void face_mesh_impl::run(const cv::Mat &face, cv::Mat &landmarks)
     [face_data release];
 }
 
-std::unique_ptr<face_mesh> face_mesh::build(const fs::path &model_dir)
+std::unique_ptr<face_mesh> build_face_mesh(const fs::path &model_dir)
 {
     fs::path model_path = model_dir / fs::path("FaceMesh.mlmodel");
     auto compiled_path = model::compile(model_path);
@@ -97,4 +97,4 @@ std::unique_ptr<face_mesh> face_mesh::build(const fs::path &model_dir)
     return std::unique_ptr<face_mesh>(new face_mesh_impl(model));
 }
 
-} // namespace lens
\ No newline at end of file
+} // namespace lens::coreml
\ No newline at end of file
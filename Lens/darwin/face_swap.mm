@@ -53,7 +53,7 @@ typedef struct
 
 const float NINE_ZEROS[9] = {0, .2, 0, .2, .2, .2, 0, 0, .2};
 
-namespace lens
+namespace lens::coreml
 {
 
 class face_swap_impl : public face_swap
@@ -90,10 +90,10 @@ face_swap_impl::face_swap_impl(const std::vector<MLModel const *> &model_pool,
     [compositor_thread start];
 }
 
-face_swap::~face_swap() = default;
-
 face_swap_impl::~face_swap_impl() noexcept
 {
+    stop_inference();
+
     for (auto model = model_pool.begin(); model != model_pool.end(); model++)
         [*model release];
 
@@ -173,12 +173,16 @@ void face_swap_impl::composite(cv::Mat &dst,
 
     if (!compositor_queue.try_push(face2face))
     {
-        delete[] reinterpret_cast<uint8_t *>(dst.data);
+        // Pass the frame on without the swap, so the pipeline still accounts for it
         std::cout << "Failed to push image to compositor" << std::endl;
+        face2face_pool.push(*job);
+        *job = nullptr;
+        callback(dst);
     }
 }
 
-std::unique_ptr<face_swap> face_swap::build(const fs::path &model_path, const fs::path &resources_dir)
+std::unique_ptr<face_swap> build_face_swap(const fs::path &model_path,
+                                           const fs::path &resources_dir)
 {
     auto compiled_path = model::compile(model_path);
     std::vector<MLModel const *> model_pool = {
@@ -208,7 +212,7 @@ std::unique_ptr<face_swap> face_swap::build(const fs::path &model_path, const fs
     return std::unique_ptr<face_swap>(new face_swap_impl(model_pool, device, compositor));
 }
 
-} // namespace lens
+} // namespace lens::coreml
 
 @implementation CompositorThread
 
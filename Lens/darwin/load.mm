@@ -10,7 +10,10 @@
 namespace
 {
 
-void load_frame(CVPixelBufferRef pixel_buffer, lens::face_pipeline &pipeline)
+void load_frame(CVPixelBufferRef pixel_buffer,
+                lens::face_pipeline &pipeline,
+                CMTime presentation_time = kCMTimeInvalid,
+                CMTime start_time = kCMTimeInvalid)
 {
     CVPixelBufferLockBaseAddress(pixel_buffer, kCVPixelBufferLock_ReadOnly);
 
@@ -19,8 +22,7 @@ void load_frame(CVPixelBufferRef pixel_buffer, lens::face_pipeline &pipeline)
     size_t width = CVPixelBufferGetWidth(pixel_buffer);
     size_t height = CVPixelBufferGetHeight(pixel_buffer);
 
-    size_t pixels_count = width * height;
-    auto *image_buffer = new uint8_t[pixels_count * 4];
+    cv::Mat image(static_cast<int>(height), static_cast<int>(width), CV_8UC4);
 
     const vImage_Buffer src{
         .data = base_address,
@@ -29,17 +31,40 @@ void load_frame(CVPixelBufferRef pixel_buffer, lens::face_pipeline &pipeline)
         .rowBytes = bytes_per_row,
     };
     const vImage_Buffer dst{
-        .data = image_buffer,
+        .data = image.data,
         .height = height,
         .width = width,
-        .rowBytes = 4 * width,
+        .rowBytes = image.step,
     };
     vImageCopyBuffer(&src, &dst, 4, kvImageNoAllocate);
 
     CVPixelBufferUnlockBaseAddress(pixel_buffer, kCVPixelBufferLock_ReadOnly);
 
-    cv::Mat image(static_cast<int>(height), static_cast<int>(width), CV_8UC4, image_buffer);
-    pipeline << image;
+    lens::frame input = {.image = image};
+
+    // Capture sessions time samples on the host clock, which the steady clock also counts
+    if (CMTIME_IS_NUMERIC(presentation_time))
+    {
+        const CMTime captured = CMTimeConvertScale(
+            presentation_time, NSEC_PER_SEC, kCMTimeRoundingMethod_RoundHalfAwayFromZero);
+
+        input.trace.captured = std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::nanoseconds(captured.value)));
+
+        // Encoders count from the first frame rather than from when the host booted
+        if (CMTIME_IS_NUMERIC(start_time))
+        {
+            const CMTime elapsed =
+                CMTimeConvertScale(CMTimeSubtract(presentation_time, start_time),
+                                   USEC_PER_SEC,
+                                   kCMTimeRoundingMethod_RoundHalfAwayFromZero);
+
+            input.pts = std::chrono::microseconds(elapsed.value);
+        }
+    }
+
+    pipeline << input;
 }
 
 } // namespace
@@ -47,6 +72,8 @@ void load_frame(CVPixelBufferRef pixel_buffer, lens::face_pipeline &pipeline)
 @interface CaptureDelegate : NSObject <AVCaptureVideoDataOutputSampleBufferDelegate>
 
 @property(nonatomic) lens::face_pipeline *pipeline;
+/** When the first sample was presented, which the frames' timestamps are measured from. */
+@property(nonatomic) CMTime startTime;
 
 - (instancetype)init:(lens::face_pipeline *)pipeline;
 
@@ -60,6 +87,7 @@ void load_frame(CVPixelBufferRef pixel_buffer, lens::face_pipeline &pipeline)
     if (self)
     {
         _pipeline = pipeline;
+        _startTime = kCMTimeInvalid;
     }
     return self;
 }
@@ -69,7 +97,12 @@ void load_frame(CVPixelBufferRef pixel_buffer, lens::face_pipeline &pipeline)
            fromConnection:(AVCaptureConnection *)connection
 {
     CVPixelBufferRef pixel_buffer = CMSampleBufferGetImageBuffer(sampleBuffer);
-    load_frame(pixel_buffer, *_pipeline);
+    const CMTime presentation_time = CMSampleBufferGetPresentationTimeStamp(sampleBuffer);
+
+    if (!CMTIME_IS_NUMERIC(_startTime))
+        _startTime = presentation_time;
+
+    load_frame(pixel_buffer, *_pipeline, presentation_time, _startTime);
 }
 
 @end
@@ -192,13 +225,13 @@ bool load_image(NSString *path, lens::face_pipeline &pipeline)
 } // namespace
 
 #ifdef LENS_FEATURE_FILE_IO
-bool load_video(const std::string &path, lens::face_pipeline &pipeline);
+bool load_video(const std::string &path, double speed, lens::face_pipeline &pipeline);
 #endif
 
 namespace lens
 {
 
-bool load(const std::string &cxx_path, int frame_rate, face_pipeline &pipeline)
+bool load(const std::string &cxx_path, int frame_rate, face_pipeline &pipeline, double speed)
 {
     NSFileManager *fileManager = [NSFileManager defaultManager];
     NSString *path = [NSString stringWithCString:cxx_path.c_str() encoding:NSASCIIStringEncoding];
@@ -210,7 +243,7 @@ bool load(const std::string &cxx_path, int frame_rate, face_pipeline &pipeline)
 
 #ifdef LENS_FEATURE_FILE_IO
         if (match(video_formats, cxx_path))
-            return load_video(cxx_path, pipeline);
+            return load_video(cxx_path, speed, pipeline);
 #endif
 
         std::cout << "Unknown file type" << std::endl;
@@ -5,8 +5,11 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <mutex>
 #include <oneapi/tbb.h>
 #include <opencv2/opencv.hpp>
+#include <thread>
 #include <tuple>
 
 namespace lens
@@ -14,6 +17,17 @@ namespace lens
 
 #pragma mark - Image Processing
 
+/**
+ * Wrap memory owned elsewhere, such as a decoder or device buffer, in a Mat without copying it.
+ * The Mat and its copies share a reference count, and release is called once the last is gone.
+ */
+cv::Mat wrap_buffer(int rows,
+                    int cols,
+                    int type,
+                    void *data,
+                    size_t step,
+                    std::function<void()> release);
+
 class filter
 {
   public:
@@ -77,7 +91,18 @@ class center_face
                      std::tuple<cv::Mat, cv::Mat> &offsets,
                      std::vector<cv::Mat> &landmarks) = 0;
     void run(const cv::Mat &image, std::vector<face_extraction> &extractions);
-    static std::unique_ptr<center_face> build(const std::filesystem::path &model_dir);
+    /**
+     * Detect faces in an image that has already been scaled to INPUT_WIDTH x INPUT_HEIGHT and
+     * converted to CV_32FC3 BGR as detector_image. An empty detector_image is derived from image.
+     */
+    void run(const cv::Mat &image,
+             const cv::Mat &detector_image,
+             std::vector<face_extraction> &extractions);
+    static std::unique_ptr<center_face> build(const std::filesystem::path &model_dir,
+                                              const std::string &backend = "");
+
+    static constexpr int INPUT_WIDTH = 640;
+    static constexpr int INPUT_HEIGHT = 480;
 };
 
 class face_mesh
@@ -86,7 +111,8 @@ class face_mesh
     virtual ~face_mesh() noexcept;
     virtual void run(const cv::Mat &face, cv::Mat &landmarks) = 0;
     void run(const cv::Mat &image, const face_extraction &face, cv::Mat &landmarks_2d);
-    static std::unique_ptr<face_mesh> build(const std::filesystem::path &model_dir);
+    static std::unique_ptr<face_mesh> build(const std::filesystem::path &model_dir,
+                                            const std::string &backend = "");
 
   protected:
     static constexpr int NORM_FACE_DIM = 192;
@@ -100,20 +126,68 @@ class face_swap
     face_swap();
     virtual ~face_swap();
     virtual face2face *run(cv::Mat &in_face) = 0;
+    /**
+     * Submit a face for inference without waiting on the model. The callback receives the result,
+     * or nullptr if inference failed, on whichever thread completed it. By default, submissions
+     * are queued onto a dedicated inference thread that calls run().
+     */
+    virtual void run_async(cv::Mat &in_face, std::function<void(face2face *)> callback);
     virtual void composite(cv::Mat &dst,
                            const face &extraction,
                            face2face **,
                            std::function<void(cv::Mat &)> callback);
 
     static std::unique_ptr<face_swap> build(const std::filesystem::path &model_path,
-                                            const std::filesystem::path &resources_dir);
+                                            const std::filesystem::path &resources_dir,
+                                            const std::string &backend = "");
     static cv::Mat color_transfer(cv::Mat &src, cv::Mat &like);
 
   protected:
-    std::unique_ptr<gaussian_blur> gaussian_blur;
+    static constexpr int MAX_INFERENCES_IN_FLIGHT = 4;
+
+    std::unique_ptr<lens::gaussian_blur> gaussian_blur;
     oneapi::tbb::concurrent_queue<face2face *> face2face_pool;
 
     cv::Mat erode_and_blur(cv::Mat &image, int erode, int blur);
+    /**
+     * Abort queued inferences and join the inference thread. Backends call this first in their
+     * destructors, because the thread calls run() until it is joined.
+     */
+    void stop_inference() noexcept;
+
+  private:
+    struct inference
+    {
+        cv::Mat in_face;
+        std::function<void(face2face *)> callback;
+    };
+
+    oneapi::tbb::concurrent_bounded_queue<inference> inference_queue;
+    std::once_flag inference_thread_once;
+    std::thread inference_thread;
+
+    void run_inference_queue();
 };
 
+#pragma mark - Inference Backends
+
+/**
+ * An inference runtime that models can be built on. Backends are compiled in through the
+ * LENS_FEATURE_* options and chosen per model at runtime by name; a backend may leave a factory
+ * empty if it cannot run that model.
+ */
+struct backend
+{
+    const char *name;
+    const char *model_extension;
+    std::unique_ptr<center_face> (*build_center_face)(const std::filesystem::path &model_dir);
+    std::unique_ptr<face_mesh> (*build_face_mesh)(const std::filesystem::path &model_dir);
+    std::unique_ptr<face_swap> (*build_face_swap)(const std::filesystem::path &model_path,
+                                                  const std::filesystem::path &resources_dir);
+};
+
+/** All backends compiled into lens, with the default first. */
+const std::vector<backend> &backends();
+const backend &find_backend(const std::string &name);
+
 } // namespace lens
\ No newline at end of file
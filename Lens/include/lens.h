@@ -1,8 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <map>
 #include <oneapi/tbb.h>
 #include <opencv2/opencv.hpp>
+#include <optional>
 #include <tuple>
 
 #include "facade.h"
@@ -22,14 +26,137 @@ struct frame_stats
         frame_write_timestamp;
 };
 
+/** How an output makes room for a new frame while its consumer is behind. */
+enum class output_policy
+{
+    /** Wait for room, holding up the pipeline, so no frame is lost. For files. */
+    block,
+    /** Drop the oldest waiting frame. For live devices. */
+    drop_oldest,
+    /** Drop every waiting frame, so only the newest is output next. */
+    latest_only,
+};
+
+/** Frame counts and latency of an output, from leaving the pipeline to being handled. */
+struct output_stats
+{
+    size_t received;
+    size_t handled;
+    /** Frames dropped while waiting to be handled, or by the output itself. */
+    size_t dropped;
+    std::chrono::microseconds latency_mean;
+    std::chrono::microseconds latency_max;
+    /** Percentiles of the glass-to-glass latency, from capture to being handled, of the latest frames. */
+    std::chrono::microseconds glass_to_glass_p50;
+    std::chrono::microseconds glass_to_glass_p90;
+    std::chrono::microseconds glass_to_glass_p99;
+};
+
+/** A frame rate in frames per second, as a fraction so rates like 30000/1001 stay exact. */
+struct rational
+{
+    int num = 0;
+    int den = 1;
+};
+
+/**
+ * When a frame reached each stage on its way from the source to an output, on the steady clock.
+ * Stages a frame has not reached yet are left at the clock's epoch.
+ */
+struct frame_trace
+{
+    /** When the source captured the image, or when it was pushed if the source cannot tell. */
+    std::chrono::steady_clock::time_point captured;
+    /** When the image was pushed into the pipeline. */
+    std::chrono::steady_clock::time_point ingested;
+    /** When the face swap of the image completed. */
+    std::chrono::steady_clock::time_point processed;
+    /** When the pipeline handed the frame to its outputs. */
+    std::chrono::steady_clock::time_point dispatched;
+    /** When an output finished handling the frame. */
+    std::chrono::steady_clock::time_point presented;
+};
+
+/**
+ * A BGRA image passing through the face pipeline. Inputs that already scale the image can attach
+ * the CenterFace input (see center_face::run) so workers skip their own resize and convert.
+ */
+struct frame
+{
+    cv::Mat image;
+    cv::Mat detector_image;
+    /** The presentation time of the image in its source, if the source has timestamps. */
+    std::optional<std::chrono::microseconds> pts;
+    /** The nominal frame rate of the source, if it has one. */
+    std::optional<rational> frame_rate;
+    /** Whether the pipeline should wait for room in its queues instead of dropping the frame. */
+    bool lossless = false;
+    /** Run only to seed face tracking; the frame is released before face swap and not output. */
+    bool warm_up = false;
+    /** The order of a lossless frame, assigned by the pipeline so its output stays in order. */
+    size_t sequence = 0;
+    /** An unrelated still image, which face tracking should neither use nor remember. */
+    bool still = false;
+    /** The file the image was loaded from, for outputs that name their files after it. */
+    std::string source;
+    /** The number of frames pushed into the pipeline before this one, dropped or not. */
+    size_t index = 0;
+    frame_trace trace;
+};
+
+/**
+ * The names of the inference backends to build each model on. An empty name selects the default.
+ */
+struct face_pipeline_backends
+{
+    std::string center_face;
+    std::string face_mesh;
+    std::string face_swap;
+};
+
+/**
+ * The models a face pipeline runs. They are safe to share between pipelines.
+ */
+struct face_pipeline_models
+{
+    std::shared_ptr<lens::center_face> center_face;
+    std::shared_ptr<lens::face_mesh> face_mesh;
+    std::shared_ptr<lens::face_swap> face_swap;
+
+    static face_pipeline_models build(const std::filesystem::path &root_dir,
+                                      const std::filesystem::path &face_swap_model,
+                                      const face_pipeline_backends &backends = {});
+};
+
+class base_output;
+
 class face_pipeline
 {
+    friend class base_output;
+
   public:
     face_pipeline(const std::filesystem::path &root_dir,
-                  const std::filesystem::path &face_swap_model);
+                  const std::filesystem::path &face_swap_model,
+                  const face_pipeline_backends &backends = {});
+    explicit face_pipeline(const face_pipeline_models &models, int workers = 4);
     ~face_pipeline();
     void operator<<(cv::Mat &image);
-    void operator>>(cv::Mat &image);
+    void operator<<(frame &input);
+    /** Push a frame without dropping it, blocking until a worker is free to take it. */
+    void push(frame &input);
+    /** Pop a processed frame. An empty image means the pipeline was closed and is drained. */
+    void operator>>(frame &output);
+    /** Stop the workers once every frame already pushed has been output. */
+    void close();
+
+    /**
+     * Shrink frames as they are pushed to fit within size, because no output needs them larger,
+     * so every stage works on fewer pixels. Set it before pushing frames; an empty size, the
+     * default, keeps frames at their source size.
+     */
+    void fit_to(const cv::Size &size);
+    /** The size a source frame is scaled to when it is pushed. Inputs can scale to it themselves. */
+    cv::Size ingest_size(const cv::Size &source) const;
 
   private:
     double frame_interval_mean;
@@ -37,33 +164,121 @@ class face_pipeline
     size_t frame_counter_write;
     std::chrono::time_point<std::chrono::steady_clock, std::chrono::nanoseconds>
         frame_write_timestamp;
+    cv::Size output_size;
 
-    std::unique_ptr<center_face> center_face;
-    std::unique_ptr<face_mesh> face_mesh;
-    std::unique_ptr<face_swap> face_swap;
+    std::shared_ptr<lens::center_face> center_face;
+    std::shared_ptr<lens::face_mesh> face_mesh;
+    std::shared_ptr<lens::face_swap> face_swap;
 
-    oneapi::tbb::concurrent_bounded_queue<cv::Mat> input_queue;
-    oneapi::tbb::concurrent_bounded_queue<cv::Mat> output_queue;
+    oneapi::tbb::concurrent_bounded_queue<frame> input_queue;
+    oneapi::tbb::concurrent_bounded_queue<frame> output_queue;
     std::vector<std::thread> thread_pool;
     bool output_ready;
     std::mutex write_mutex;
+    bool closed;
+
+    std::atomic<size_t> frames_in_flight;
+    std::atomic<size_t> next_sequence_in;
+    size_t next_sequence_out;
+    std::map<size_t, frame> reorder_buffer;
+    std::mutex reorder_mutex;
+
+    /** The outputs reading from the pipeline; the first one pipes every frame to all of them. */
+    std::vector<base_output *> outputs;
+    std::mutex outputs_mutex;
 
-    [[noreturn]] void run();
+    void run();
+    void ingest(frame &input);
+    void fit(frame &input) const;
     template <typename T>
     void run_temporal_smoothing(std::vector<T> &observed_faces,
                                 const std::vector<face> &remembered_faces,
                                 const std::function<void(T &, const face &)> &callback);
     void run_face_alignment(cv::Mat &, const std::vector<face_extraction> &, std::vector<face> &);
     void run_face_swap(cv::Mat &, const std::vector<face> &, std::function<void(cv::Mat &)>);
-    void submit(cv::Mat &);
+    void submit(frame &);
 
     static cv::Mat umeyama2(const cv::Mat &src, const cv::Mat &dst);
     static void smooth_face_bounds(face_extraction &observed_face, const face &remembered_face);
 };
 
-class base_output;
+/** The framing of uncompressed video on stdin and stdout. */
+enum class stream_format
+{
+    y4m,
+    bgra,
+};
+
+/**
+ * Settings for H.264 file outputs and stdout streams. A bit rate of zero encodes at the constant
+ * rate factor instead, and zeroes leave the GOP length and thread count to the encoder.
+ */
+struct encoder_options
+{
+    std::string preset = "veryfast";
+    std::string tune;
+    int crf = 23;
+    int64_t bit_rate = 0;
+    int gop_size = 0;
+    int threads = 0;
+    /** The frame rate assumed for frames that have no timestamps or whose source has no rate. */
+    int frame_rate = 30;
+    /** The framing of video written to stdout with a dst of "-". */
+    stream_format stream = stream_format::y4m;
+    /**
+     * The length of MP4 fragments, or of the chunks written for a .m3u8 dst, in seconds. A
+     * positive duration writes MP4 and MOV files as fragments that can be read while they grow.
+     */
+    double fragment_duration = 0;
+    /** The container of the chunks written for a .m3u8 dst: mpegts or mp4. */
+    std::string segment_format = "mpegts";
+    /**
+     * The frames a Facade device dst may hold written but not yet consumed. The default matches
+     * libfacade's four-frame device queues, one frame of which a reader may be holding.
+     */
+    int device_queue_depth = 3;
+};
+
+/**
+ * Feed a camera, image, or video file into the pipeline. Video files are paced by their
+ * timestamps at the given speed, dropping frames that fall behind; a speed of zero feeds frames as
+ * fast as the pipeline can absorb them, without dropping any.
+ */
+bool load(const std::string &media, int frame_rate, face_pipeline &, double speed = 1);
+/**
+ * Feed uncompressed video from stdin into the pipeline without dropping frames, until stdin is
+ * closed. An empty raw_size reads a Y4M stream; otherwise stdin carries bare BGRA frames of that
+ * size at the given frame rate.
+ */
+bool load_stream(face_pipeline &, int frame_rate, cv::Size raw_size = {});
+std::unique_ptr<base_output> output(face_pipeline &pipeline,
+                                    std::string &dst,
+                                    bool loop,
+                                    const encoder_options &encoder = {});
+
+/**
+ * Process a video file as independent segments split at keyframes, each on its own single-worker
+ * pipeline sharing the models, and losslessly join the encoded segments into dst.
+ */
+bool transcode(const std::string &src,
+               const std::string &dst,
+               int segments,
+               const face_pipeline_models &models,
+               const encoder_options &encoder = {});
+
+/**
+ * Whether src names a batch of images: a directory, a glob pattern, or a list file (.txt or .lst)
+ * with one path per line.
+ */
+bool is_batch(const std::string &src);
 
-bool load(const std::string &media, int frame_rate, face_pipeline &);
-std::unique_ptr<base_output> output(face_pipeline &pipeline, std::string &dst, bool loop);
+/**
+ * Swap faces in a batch of images across all cores, writing each into the dst directory under its
+ * own file name. Images whose output already exists are skipped if skip_existing is set.
+ */
+bool batch(const std::string &src,
+           const std::string &dst,
+           bool skip_existing,
+           const face_pipeline_models &models);
 
 } // namespace lens
\ No newline at end of file
@@ -0,0 +1,592 @@
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <oneapi/tbb.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifdef LENS_FEATURE_IO_URING
+#include <liburing.h>
+#endif
+
+#include "async_io.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+/** Bytes moved per read or write submitted to the kernel. */
+constexpr size_t BLOCK_SIZE = 1 << 20;
+constexpr size_t BLOCK_ALIGNMENT = 4096;
+/** Blocks read ahead of, or written behind, the position FFmpeg is at. */
+constexpr int QUEUE_DEPTH = 4;
+/** The AVIOContext's own buffer, which FFmpeg fills or drains a packet at a time. */
+constexpr int AVIO_BUFFER_SIZE = 1 << 16;
+
+struct block
+{
+    uint8_t *data;
+    int64_t offset;
+    size_t length;
+    bool write;
+    size_t done;
+    /** Bytes transferred once complete, or an AVERROR code. */
+    ssize_t result;
+    bool pending;
+};
+
+ssize_t transfer(int fd, block &target)
+{
+    while (target.done < target.length)
+    {
+        uint8_t *data = target.data + target.done;
+        const size_t remaining = target.length - target.done;
+        const off_t at = target.offset + static_cast<off_t>(target.done);
+        const ssize_t count =
+            target.write ? pwrite(fd, data, remaining, at) : pread(fd, data, remaining, at);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return AVERROR(errno);
+        if (count == 0)
+            break;
+
+        target.done += count;
+    }
+
+    return static_cast<ssize_t>(target.done);
+}
+
+/** Runs block transfers for one file. Blocks are owned by the caller and must outlive the wait. */
+class io_engine
+{
+  public:
+    virtual ~io_engine() = default;
+    virtual void submit(block &target) = 0;
+    virtual void wait(block &target) = 0;
+};
+
+/** Transfers blocks in order on a background thread with pread and pwrite. */
+class thread_engine : public io_engine
+{
+  public:
+    explicit thread_engine(int fd) : fd(fd), worker(&thread_engine::run, this) { }
+
+    ~thread_engine() override
+    {
+        requests.push(nullptr);
+        worker.join();
+    }
+
+    void submit(block &target) override
+    {
+        target.done = 0;
+        target.pending = true;
+        requests.push(&target);
+    }
+
+    void wait(block &target) override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        completed.wait(lock, [&target] { return !target.pending; });
+    }
+
+  private:
+    int fd;
+    oneapi::tbb::concurrent_bounded_queue<block *> requests;
+    std::mutex mutex;
+    std::condition_variable completed;
+    std::thread worker;
+
+    void run()
+    {
+        block *target;
+
+        while (true)
+        {
+            requests.pop(target);
+            if (!target)
+                break;
+
+            const ssize_t result = transfer(fd, *target);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                target->result = result;
+                target->pending = false;
+            }
+            completed.notify_all();
+        }
+    }
+};
+
+#ifdef LENS_FEATURE_IO_URING
+/**
+ * Transfers blocks on an io_uring, reaping completions on the thread that waits for them. Short
+ * writes are resubmitted for the remainder; a short read ends the block where the file did.
+ */
+class uring_engine : public io_engine
+{
+  public:
+    explicit uring_engine(int fd) : fd(fd)
+    {
+        if (io_uring_queue_init(QUEUE_DEPTH, &ring, 0) < 0)
+            throw std::runtime_error("Failed to create an io_uring");
+    }
+
+    ~uring_engine() override { io_uring_queue_exit(&ring); }
+
+    void submit(block &target) override
+    {
+        target.done = 0;
+        target.pending = true;
+        queue(target);
+    }
+
+    void wait(block &target) override
+    {
+        while (target.pending)
+        {
+            io_uring_cqe *completion = nullptr;
+            const int code = io_uring_wait_cqe(&ring, &completion);
+            if (code == -EINTR)
+                continue;
+            if (code < 0)
+            {
+                target.result = code;
+                target.pending = false;
+                return;
+            }
+
+            auto *finished = static_cast<block *>(io_uring_cqe_get_data(completion));
+            const int result = completion->res;
+            io_uring_cqe_seen(&ring, completion);
+            complete(*finished, result);
+        }
+    }
+
+  private:
+    int fd;
+    io_uring ring;
+
+    void queue(block &target)
+    {
+        io_uring_sqe *entry = io_uring_get_sqe(&ring);
+        uint8_t *data = target.data + target.done;
+        const unsigned remaining = target.length - target.done;
+        const off_t at = target.offset + static_cast<off_t>(target.done);
+
+        if (target.write)
+            io_uring_prep_write(entry, fd, data, remaining, at);
+        else
+            io_uring_prep_read(entry, fd, data, remaining, at);
+
+        io_uring_sqe_set_data(entry, &target);
+        io_uring_submit(&ring);
+    }
+
+    void complete(block &target, int result)
+    {
+        if (result == -EINTR || result == -EAGAIN)
+        {
+            queue(target);
+            return;
+        }
+        if (result < 0)
+        {
+            target.result = result;
+            target.pending = false;
+            return;
+        }
+
+        target.done += result;
+        if (target.write && result > 0 && target.done < target.length)
+        {
+            queue(target);
+            return;
+        }
+
+        target.result = static_cast<ssize_t>(target.done);
+        target.pending = false;
+    }
+};
+#endif
+
+std::unique_ptr<io_engine> make_engine(int fd)
+{
+#ifdef LENS_FEATURE_IO_URING
+    try
+    {
+        return std::make_unique<uring_engine>(fd);
+    }
+    catch (std::runtime_error &)
+    {
+        // io_uring may be missing from the kernel or blocked by a seccomp policy
+    }
+#endif
+    return std::make_unique<thread_engine>(fd);
+}
+
+/**
+ * The state behind one AVIOContext. Reads are served from a window of blocks fetched ahead of the
+ * position, which restarts wherever a seek lands outside it. Writes are gathered into a block
+ * that is submitted once full, and all of them are drained before a seek moves the position.
+ */
+class async_file
+{
+  public:
+    async_file(int fd, bool writing, int64_t size) :
+        fd(fd),
+        writing(writing),
+        size(size),
+        position(0),
+        next_offset(0),
+        error(0),
+        engine(make_engine(fd)),
+        blocks(QUEUE_DEPTH),
+        in_flight(),
+        idle(),
+        filling(nullptr)
+    {
+        for (auto &buffer : blocks)
+        {
+            buffer.data = static_cast<uint8_t *>(std::aligned_alloc(BLOCK_ALIGNMENT, BLOCK_SIZE));
+            if (!buffer.data)
+            {
+                for (auto &allocated : blocks)
+                    std::free(allocated.data);
+                throw std::bad_alloc();
+            }
+            idle.push_back(&buffer);
+        }
+    }
+
+    ~async_file() noexcept
+    {
+        if (fd >= 0)
+            close();
+        for (auto &buffer : blocks)
+            std::free(buffer.data);
+    }
+
+    int read(uint8_t *buffer, int buffer_size)
+    {
+        while (position < size)
+        {
+            if (in_flight.empty() || position < in_flight.front()->offset ||
+                position >= in_flight.front()->offset +
+                                static_cast<int64_t>(in_flight.front()->length))
+                read_ahead_from(position);
+
+            block &front = *in_flight.front();
+            engine->wait(front);
+            if (front.result < 0)
+                return static_cast<int>(front.result);
+
+            const int64_t end = front.offset + front.result;
+            int copied = 0;
+
+            if (position < end)
+            {
+                copied = static_cast<int>(std::min<int64_t>(buffer_size, end - position));
+                std::memcpy(buffer, front.data + (position - front.offset), copied);
+                position += copied;
+            }
+
+            // The block is used up, or a short read ended it before the position
+            if (position >= end)
+            {
+                in_flight.pop_front();
+                idle.push_back(&front);
+                if (front.result == 0)
+                    return copied > 0 ? copied : AVERROR_EOF;
+                read_ahead();
+            }
+
+            if (copied > 0)
+                return copied;
+        }
+
+        return AVERROR_EOF;
+    }
+
+    int write(const uint8_t *buffer, int buffer_size)
+    {
+        int written = 0;
+
+        while (written < buffer_size && !error)
+        {
+            if (!filling)
+            {
+                filling = take_idle();
+                filling->offset = position;
+                filling->length = 0;
+            }
+
+            const size_t count =
+                std::min<size_t>(buffer_size - written, BLOCK_SIZE - filling->length);
+            std::memcpy(filling->data + filling->length, buffer + written, count);
+            filling->length += count;
+            position += static_cast<int64_t>(count);
+            written += static_cast<int>(count);
+            size = std::max(size, position);
+
+            if (filling->length == BLOCK_SIZE)
+                submit_filling();
+        }
+
+        return error ? error : written;
+    }
+
+    int64_t seek(int64_t offset, int whence)
+    {
+        int64_t target;
+
+        switch (whence & ~AVSEEK_FORCE)
+        {
+        case AVSEEK_SIZE:
+            return size;
+        case SEEK_SET:
+            target = offset;
+            break;
+        case SEEK_CUR:
+            target = position + offset;
+            break;
+        case SEEK_END:
+            target = size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+        }
+
+        if (target < 0)
+            return AVERROR(EINVAL);
+
+        // Muxers seek back to patch headers, and io_uring does not order overlapping writes
+        if (writing && target != position)
+            flush();
+        if (error)
+            return error;
+
+        position = target;
+        return target;
+    }
+
+    /** Drain outstanding I/O and close the file, returning the first error encountered. */
+    int close()
+    {
+        if (writing)
+            flush();
+        else
+            drain();
+
+        engine.reset();
+        if (::close(fd) < 0 && !error)
+            error = AVERROR(errno);
+        fd = -1;
+
+        return error;
+    }
+
+  private:
+    int fd;
+    bool writing;
+    /** The file's size when reading, or the furthest byte written when writing. */
+    int64_t size;
+    int64_t position;
+    int64_t next_offset;
+    int error;
+    std::unique_ptr<io_engine> engine;
+    std::vector<block> blocks;
+    std::deque<block *> in_flight;
+    std::vector<block *> idle;
+    block *filling;
+
+    void read_ahead()
+    {
+        while (!idle.empty() && next_offset < size)
+        {
+            block *next = idle.back();
+            idle.pop_back();
+
+            next->offset = next_offset;
+            next->length = static_cast<size_t>(std::min<int64_t>(BLOCK_SIZE, size - next_offset));
+            next->write = false;
+            engine->submit(*next);
+            in_flight.push_back(next);
+            next_offset += static_cast<int64_t>(next->length);
+        }
+    }
+
+    void read_ahead_from(int64_t offset)
+    {
+        drain();
+        next_offset = offset - offset % static_cast<int64_t>(BLOCK_ALIGNMENT);
+        read_ahead();
+    }
+
+    void submit_filling()
+    {
+        filling->write = true;
+        engine->submit(*filling);
+        in_flight.push_back(filling);
+        filling = nullptr;
+    }
+
+    block *take_idle()
+    {
+        while (idle.empty())
+            retire();
+
+        block *next = idle.back();
+        idle.pop_back();
+        return next;
+    }
+
+    void retire()
+    {
+        block *oldest = in_flight.front();
+        engine->wait(*oldest);
+        in_flight.pop_front();
+        idle.push_back(oldest);
+
+        if (writing && !error && oldest->result < static_cast<ssize_t>(oldest->length))
+            error = oldest->result < 0 ? static_cast<int>(oldest->result) : AVERROR(EIO);
+    }
+
+    void drain()
+    {
+        while (!in_flight.empty())
+            retire();
+    }
+
+    void flush()
+    {
+        if (filling && filling->length > 0)
+            submit_filling();
+        else if (filling)
+        {
+            idle.push_back(filling);
+            filling = nullptr;
+        }
+
+        drain();
+    }
+};
+
+int read_packet(void *opaque, uint8_t *buffer, int size)
+{
+    return static_cast<async_file *>(opaque)->read(buffer, size);
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int write_packet(void *opaque, const uint8_t *buffer, int size)
+#else
+int write_packet(void *opaque, uint8_t *buffer, int size)
+#endif
+{
+    return static_cast<async_file *>(opaque)->write(buffer, size);
+}
+
+int64_t seek(void *opaque, int64_t offset, int whence)
+{
+    return static_cast<async_file *>(opaque)->seek(offset, whence);
+}
+
+} // namespace
+
+namespace lens
+{
+
+AVIOContext *open_async_io(const std::string &path, bool write)
+{
+    std::error_code status_error;
+    const fs::file_status status = fs::status(path, status_error);
+
+    // Pipes, devices and URLs are left to FFmpeg's own protocols
+    if (write ? fs::exists(status) && !fs::is_regular_file(status) : !fs::is_regular_file(status))
+        return nullptr;
+
+    const int fd = write ? ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+                         : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat info{};
+    if (fstat(fd, &info) < 0)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (!write)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    async_file *file;
+    try
+    {
+        file = new async_file(fd, write, write ? 0 : info.st_size);
+    }
+    catch (std::exception &)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    auto *buffer = static_cast<unsigned char *>(av_malloc(AVIO_BUFFER_SIZE));
+    AVIOContext *context = buffer ? avio_alloc_context(buffer,
+                                                       AVIO_BUFFER_SIZE,
+                                                       write,
+                                                       file,
+                                                       write ? nullptr : read_packet,
+                                                       write ? write_packet : nullptr,
+                                                       seek)
+                                  : nullptr;
+
+    if (!context)
+    {
+        av_free(buffer);
+        delete file;
+        return nullptr;
+    }
+
+    return context;
+}
+
+bool close_async_io(AVIOContext **context)
+{
+    if (!*context)
+        return true;
+
+    avio_flush(*context);
+
+    auto *file = static_cast<async_file *>((*context)->opaque);
+    const bool succeeded = file->close() == 0 && (*context)->error == 0;
+    delete file;
+
+    av_freep(&(*context)->buffer);
+    avio_context_free(context);
+
+    return succeeded;
+}
+
+} // namespace lens
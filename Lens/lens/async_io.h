@@ -0,0 +1,25 @@
+#pragma once
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+#include <string>
+
+namespace lens
+{
+
+/**
+ * Open a local file as an AVIOContext that reads ahead of, or writes behind, the demuxer or muxer
+ * using it. Data moves in large aligned blocks on an io_uring when lens is built with
+ * LENS_FEATURE_IO_URING and the kernel allows it, and on a background I/O thread otherwise.
+ *
+ * Returns nullptr if the path is not a regular file, so callers can fall back to avio_open.
+ * Seeking is supported; writes are drained before the position moves.
+ */
+AVIOContext *open_async_io(const std::string &path, bool write);
+
+/** Flush and close a context from open_async_io, returning false if any read or write failed. */
+bool close_async_io(AVIOContext **context);
+
+} // namespace lens
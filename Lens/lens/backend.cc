@@ -0,0 +1,143 @@
+#include <stdexcept>
+
+#include "internal.h"
+
+namespace fs = std::filesystem;
+
+namespace lens
+{
+
+#ifdef LENS_FEATURE_COREML
+namespace coreml
+{
+std::unique_ptr<center_face> build_center_face(const fs::path &model_dir);
+std::unique_ptr<face_mesh> build_face_mesh(const fs::path &model_dir);
+std::unique_ptr<face_swap> build_face_swap(const fs::path &model_path,
+                                           const fs::path &resources_dir);
+} // namespace coreml
+#endif
+
+#ifdef LENS_FEATURE_ONNX
+namespace onnx
+{
+std::unique_ptr<center_face> build_center_face(const fs::path &model_dir);
+std::unique_ptr<face_mesh> build_face_mesh(const fs::path &model_dir);
+std::unique_ptr<face_swap> build_face_swap(const fs::path &model_path,
+                                           const fs::path &resources_dir);
+} // namespace onnx
+#endif
+
+#ifdef LENS_FEATURE_OPENCV_DNN
+namespace opencv
+{
+std::unique_ptr<center_face> build_center_face(const fs::path &model_dir);
+std::unique_ptr<face_mesh> build_face_mesh(const fs::path &model_dir);
+std::unique_ptr<face_swap> build_face_swap(const fs::path &model_path,
+                                           const fs::path &resources_dir);
+} // namespace opencv
+#endif
+
+namespace
+{
+
+const std::vector<backend> registry = {
+#ifdef LENS_FEATURE_COREML
+    {
+        .name = "coreml",
+        .model_extension = ".mlmodel",
+        .build_center_face = coreml::build_center_face,
+        .build_face_mesh = coreml::build_face_mesh,
+        .build_face_swap = coreml::build_face_swap,
+    },
+#endif
+#ifdef LENS_FEATURE_ONNX
+    {
+        .name = "onnx",
+        .model_extension = ".onnx",
+        .build_center_face = onnx::build_center_face,
+        .build_face_mesh = onnx::build_face_mesh,
+        .build_face_swap = onnx::build_face_swap,
+    },
+#endif
+#ifdef LENS_FEATURE_OPENCV_DNN
+    {
+        .name = "opencv",
+        .model_extension = ".onnx",
+        .build_center_face = opencv::build_center_face,
+        .build_face_mesh = opencv::build_face_mesh,
+        .build_face_swap = opencv::build_face_swap,
+    },
+#endif
+};
+
+const backend &default_backend()
+{
+    if (registry.empty())
+        throw std::runtime_error("Lens was built without any inference backends");
+
+    return registry.front();
+}
+
+} // namespace
+
+const std::vector<backend> &backends() { return registry; }
+
+const backend &find_backend(const std::string &name)
+{
+    if (name.empty())
+        return default_backend();
+
+    for (const auto &candidate : registry)
+        if (name == candidate.name)
+            return candidate;
+
+    throw std::runtime_error("The inference backend " + name + " is not available");
+}
+
+std::unique_ptr<center_face> center_face::build(const fs::path &model_dir,
+                                                const std::string &backend)
+{
+    const auto &chosen = find_backend(backend);
+    if (!chosen.build_center_face)
+        throw std::runtime_error(std::string("CenterFace is not supported by ") + chosen.name);
+
+    return chosen.build_center_face(model_dir);
+}
+
+std::unique_ptr<face_mesh> face_mesh::build(const fs::path &model_dir, const std::string &backend)
+{
+    const auto &chosen = find_backend(backend);
+    if (!chosen.build_face_mesh)
+        throw std::runtime_error(std::string("FaceMesh is not supported by ") + chosen.name);
+
+    return chosen.build_face_mesh(model_dir);
+}
+
+std::unique_ptr<face_swap> face_swap::build(const fs::path &model_path,
+                                            const fs::path &resources_dir,
+                                            const std::string &backend)
+{
+    const lens::backend *chosen = nullptr;
+
+    // The face-swap model is passed as a file, so its format picks the backend when none is given
+    if (backend.empty())
+    {
+        for (const auto &candidate : registry)
+        {
+            if (model_path.extension() == candidate.model_extension)
+            {
+                chosen = &candidate;
+                break;
+            }
+        }
+    }
+
+    if (!chosen)
+        chosen = &find_backend(backend);
+    if (!chosen->build_face_swap)
+        throw std::runtime_error(std::string("Face swap is not supported by ") + chosen->name);
+
+    return chosen->build_face_swap(model_path, resources_dir);
+}
+
+} // namespace lens
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fnmatch.h>
+#include <fstream>
+#include <iostream>
+#include <oneapi/tbb.h>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lens.h"
+#include "output/image_sequence_output.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+std::vector<std::string> image_formats = {".jpg", ".jpeg", ".png", ".gif", ".bmp"};
+std::vector<std::string> list_formats = {".txt", ".lst"};
+
+bool has_extension(const std::vector<std::string> &extensions, const fs::path &path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+bool is_glob(const std::string &src) { return src.find_first_of("*?[") != std::string::npos; }
+
+std::vector<fs::path> list_images(const std::string &src)
+{
+    std::vector<fs::path> images;
+
+    if (fs::is_directory(src))
+    {
+        for (const auto &entry : fs::directory_iterator(src))
+            if (entry.is_regular_file() && has_extension(image_formats, entry.path()))
+                images.push_back(entry.path());
+    }
+    else if (is_glob(src))
+    {
+        const fs::path pattern{src};
+        const fs::path directory = pattern.has_parent_path() ? pattern.parent_path() : ".";
+        const std::string filename_pattern = pattern.filename().string();
+
+        for (const auto &entry : fs::directory_iterator(directory))
+            if (entry.is_regular_file() &&
+                fnmatch(filename_pattern.c_str(), entry.path().filename().c_str(), 0) == 0)
+                images.push_back(entry.path());
+    }
+    else
+    {
+        std::ifstream list(src);
+        std::string line;
+
+        while (std::getline(list, line))
+            if (!line.empty())
+                images.emplace_back(line);
+    }
+
+    std::sort(images.begin(), images.end());
+    return images;
+}
+
+} // namespace
+
+namespace lens
+{
+
+bool is_batch(const std::string &src)
+{
+    return fs::is_directory(src) || is_glob(src) ||
+           (fs::is_regular_file(src) && has_extension(list_formats, src));
+}
+
+bool batch(const std::string &src,
+           const std::string &dst,
+           bool skip_existing,
+           const face_pipeline_models &models)
+{
+    std::vector<fs::path> images = list_images(src);
+
+    // Images are written under their file names alone, so two that share one would overwrite
+    // each other
+    std::set<fs::path> names;
+    for (const fs::path &image : images)
+    {
+        if (!names.insert(image.filename()).second)
+        {
+            std::cerr << "More than one image in " << src << " is named " << image.filename()
+                      << std::endl;
+            return false;
+        }
+    }
+
+    if (skip_existing)
+    {
+        const size_t listed = images.size();
+        std::erase_if(images,
+                      [&dst](const fs::path &image) {
+                          return fs::exists(image_sequence_output::output_path(dst, image));
+                      });
+        std::cout << "Skipping " << listed - images.size() << " images already in " << dst
+                  << std::endl;
+    }
+
+    if (images.empty())
+    {
+        std::cout << "No images to process in " << src << std::endl;
+        return true;
+    }
+
+    const int workers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const auto started = std::chrono::steady_clock::now();
+
+    face_pipeline pipeline(models, workers);
+    image_sequence_output output(pipeline, dst);
+
+    // Images are decoded in parallel but pushed in their listed order, with enough in flight to
+    // keep every worker busy
+    auto next = images.begin();
+    oneapi::tbb::parallel_pipeline(
+        2 * workers,
+        oneapi::tbb::make_filter<void, fs::path>(oneapi::tbb::filter_mode::serial_in_order,
+                                                 [&](oneapi::tbb::flow_control &control)
+                                                 {
+                                                     if (next == images.end())
+                                                     {
+                                                         control.stop();
+                                                         return fs::path();
+                                                     }
+
+                                                     return *next++;
+                                                 }) &
+            oneapi::tbb::make_filter<fs::path, frame>(
+                oneapi::tbb::filter_mode::parallel,
+                [](const fs::path &path)
+                {
+                    frame input = {.still = true, .source = path.string()};
+                    cv::Mat image = cv::imread(path.string(), cv::IMREAD_COLOR);
+
+                    if (image.empty())
+                        std::cerr << "There was an error decoding the image " << path << std::endl;
+                    else
+                        cv::cvtColor(image, input.image, cv::COLOR_BGR2BGRA);
+
+                    return input;
+                }) &
+            oneapi::tbb::make_filter<frame, void>(oneapi::tbb::filter_mode::serial_in_order,
+                                                  [&pipeline](frame input)
+                                                  {
+                                                      if (!input.image.empty())
+                                                          pipeline.push(input);
+                                                  }));
+
+    pipeline.close();
+    output.join();
+    output.wait();
+
+    const double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "Processed " << output.written() << " of " << images.size() << " images in "
+              << elapsed << "s (" << static_cast<double>(output.written()) / elapsed
+              << " images/sec)" << std::endl;
+
+    return output.written() == images.size();
+}
+
+} // namespace lens
@@ -0,0 +1,67 @@
+#include "internal.h"
+
+namespace lens
+{
+
+namespace
+{
+
+/**
+ * Owns the UMatData of wrapped buffers. OpenCV calls deallocate once the last Mat referring to the
+ * buffer is released, which hands it back through the release function kept in userdata. New
+ * allocations are left to OpenCV's own allocator.
+ */
+class release_allocator : public cv::MatAllocator
+{
+  public:
+    cv::UMatData *allocate(int dims,
+                           const int *sizes,
+                           int type,
+                           void *data,
+                           size_t *step,
+                           cv::AccessFlag flags,
+                           cv::UMatUsageFlags usage) const override
+    {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+    }
+
+    bool allocate(cv::UMatData *data, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override
+    {
+        return cv::Mat::getStdAllocator()->allocate(data, flags, usage);
+    }
+
+    void deallocate(cv::UMatData *data) const override
+    {
+        auto *release = static_cast<std::function<void()> *>(data->userdata);
+
+        (*release)();
+        delete release;
+        delete data;
+    }
+};
+
+const release_allocator allocator;
+
+} // namespace
+
+cv::Mat wrap_buffer(int rows,
+                    int cols,
+                    int type,
+                    void *data,
+                    size_t step,
+                    std::function<void()> release)
+{
+    auto *u = new cv::UMatData(&allocator);
+    u->data = u->origdata = static_cast<uchar *>(data);
+    u->size = step * rows;
+    u->flags = cv::UMatData::USER_ALLOCATED;
+    u->userdata = new std::function<void()>(std::move(release));
+
+    cv::Mat mat(rows, cols, type, data, step);
+    mat.u = u;
+    u->refcount = 1;
+
+    return mat;
+}
+
+} // namespace lens
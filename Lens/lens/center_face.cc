@@ -11,10 +11,21 @@ center_face::~center_face() noexcept = default;
 
 void center_face::run(const cv::Mat &image, std::vector<face_extraction> &extractions)
 {
-    cv::Mat resized_image;
-    cv::resize(image, resized_image, cv::Size(640, 480));
-    cv::cvtColor(resized_image, resized_image, cv::COLOR_BGRA2BGR);
-    resized_image.convertTo(resized_image, CV_32FC3);
+    run(image, cv::Mat(), extractions);
+}
+
+void center_face::run(const cv::Mat &image,
+                      const cv::Mat &detector_image,
+                      std::vector<face_extraction> &extractions)
+{
+    cv::Mat resized_image = detector_image;
+
+    if (resized_image.empty())
+    {
+        cv::resize(image, resized_image, cv::Size(INPUT_WIDTH, INPUT_HEIGHT));
+        cv::cvtColor(resized_image, resized_image, cv::COLOR_BGRA2BGR);
+        resized_image.convertTo(resized_image, CV_32FC3);
+    }
 
     cv::Mat heatmap;
     std::tuple<cv::Mat, cv::Mat> scales;
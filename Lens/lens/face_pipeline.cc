@@ -16,16 +16,38 @@ namespace fs = std::filesystem;
 namespace lens
 {
 
-face_pipeline::face_pipeline(const fs::path &root_dir, const fs::path &face_swap_model) :
+face_pipeline_models face_pipeline_models::build(const fs::path &root_dir,
+                                                 const fs::path &face_swap_model,
+                                                 const face_pipeline_backends &backends)
+{
+    return {
+        .center_face = center_face::build(root_dir, backends.center_face),
+        .face_mesh = face_mesh::build(root_dir, backends.face_mesh),
+        .face_swap = face_swap::build(face_swap_model, root_dir, backends.face_swap),
+    };
+}
+
+face_pipeline::face_pipeline(const fs::path &root_dir,
+                             const fs::path &face_swap_model,
+                             const face_pipeline_backends &backends) :
+    face_pipeline(face_pipeline_models::build(root_dir, face_swap_model, backends))
+{ }
+
+face_pipeline::face_pipeline(const face_pipeline_models &models, int workers) :
     frame_interval_mean(30.0),
     frame_counter_read(0),
     frame_counter_write(0),
     frame_write_timestamp(std::chrono::high_resolution_clock::now()),
-    center_face(center_face::build(root_dir)),
-    face_mesh(face_mesh::build(root_dir)),
-    face_swap(face_swap::build(face_swap_model, root_dir)),
+    output_size(),
+    center_face(models.center_face),
+    face_mesh(models.face_mesh),
+    face_swap(models.face_swap),
     input_queue(),
-    output_queue()
+    output_queue(),
+    closed(false),
+    frames_in_flight(0),
+    next_sequence_in(0),
+    next_sequence_out(0)
 {
     assert(center_face != nullptr);
     assert(face_mesh != nullptr);
@@ -42,47 +64,142 @@ face_pipeline::face_pipeline(const fs::path &root_dir, const fs::path &face_swap
     const int pool_capacity = 4;
     input_queue.set_capacity(pool_capacity);
     output_queue.set_capacity(pool_capacity);
-    for (int i = 0; i < pool_capacity; i++)
+    for (int i = 0; i < workers; i++)
         thread_pool.emplace_back(&face_pipeline::run, this);
 }
 
-face_pipeline::~face_pipeline() noexcept = default;
+face_pipeline::~face_pipeline() noexcept { close(); }
 
 void face_pipeline::operator<<(cv::Mat &image)
 {
-    ++frame_counter_read;
-    auto *data = reinterpret_cast<uint8_t *>(image.data);
+    frame input = {.image = image};
+    *this << input;
+}
+
+void face_pipeline::operator<<(frame &input)
+{
+    ingest(input);
+    ++frames_in_flight;
+
+    if (!this->input_queue.try_push(std::move(input)))
+        --frames_in_flight;
+}
+
+void face_pipeline::push(frame &input)
+{
+    ingest(input);
+    ++frames_in_flight;
+    input.lossless = true;
+    if (!input.warm_up)
+        input.sequence = next_sequence_in++;
+
+    input_queue.push(std::move(input));
+}
+
+void face_pipeline::operator>>(frame &output) { output_queue.pop(output); }
+
+void face_pipeline::fit_to(const cv::Size &size) { output_size = size; }
+
+cv::Size face_pipeline::ingest_size(const cv::Size &source) const
+{
+    if (output_size.empty() || source.empty())
+        return source;
+
+    // The same fit as a letterboxing output, so it can use the frame without scaling it again
+    const double scale = std::min(1.0,
+                                  std::min(static_cast<double>(output_size.width) / source.width,
+                                           static_cast<double>(output_size.height) / source.height));
+
+    return {std::max(1, static_cast<int>(source.width * scale)),
+            std::max(1, static_cast<int>(source.height * scale))};
+}
+
+void face_pipeline::ingest(frame &input)
+{
+    input.index = frame_counter_read++;
+    input.trace.ingested = std::chrono::steady_clock::now();
+    if (input.trace.captured == std::chrono::steady_clock::time_point())
+        input.trace.captured = input.trace.ingested;
+
+    fit(input);
+}
+
+void face_pipeline::fit(frame &input) const
+{
+    const cv::Size size = ingest_size(input.image.size());
+
+    if (size != input.image.size())
+        cv::resize(input.image, input.image, size, 0, 0, cv::INTER_AREA);
+}
 
-    if (!this->input_queue.try_push(std::move(image)))
+void face_pipeline::close()
+{
+    if (closed)
+        return;
+
+    closed = true;
+
+    // Each worker exits when it pops an empty frame, after the frames queued ahead of it
+    for (size_t i = 0; i < thread_pool.size(); i++)
     {
-        delete[] data;
+        frame end_of_stream;
+        input_queue.push(end_of_stream);
     }
-}
 
-void face_pipeline::operator>>(cv::Mat &image) { output_queue.pop(image); }
+    for (auto &worker : thread_pool)
+        worker.join();
 
-[[noreturn]] void face_pipeline::run()
+    // Face swaps still running asynchronously submit their frames from the inference thread
+    while (frames_in_flight > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    frame end_of_stream;
+    output_queue.push(end_of_stream);
+}
+
+void face_pipeline::run()
 {
-    cv::Mat image;
+    frame input;
     std::vector<face_extraction> extractions;
     std::vector<face> faces;
     std::vector<face> face_memory;
 
     while (true)
     {
-        input_queue.pop(image);
+        input_queue.pop(input);
 
+        if (input.image.empty())
+            break;
+
+        cv::Mat &image = input.image;
         extractions.clear();
         faces.clear();
 
-        center_face->run(image, extractions);
-        run_temporal_smoothing<face_extraction>(
-            extractions, face_memory, face_pipeline::smooth_face_bounds);
+        center_face->run(image, input.detector_image, extractions);
+        if (!input.still)
+            run_temporal_smoothing<face_extraction>(
+                extractions, face_memory, face_pipeline::smooth_face_bounds);
         run_face_alignment(image, extractions, faces);
 
-        face_memory = faces;
+        if (!input.still)
+            face_memory = faces;
 
-        run_face_swap(image, faces, [this](cv::Mat &image) { this->submit(image); });
+        if (input.warm_up)
+        {
+            --frames_in_flight;
+            continue;
+        }
+
+        frame output = input;
+        output.detector_image = cv::Mat();
+
+        run_face_swap(image,
+                      faces,
+                      [this, output = std::move(output)](cv::Mat &image) mutable
+                      {
+                          output.image = image;
+                          this->submit(output);
+                      });
     }
 }
 
@@ -207,12 +324,17 @@ void face_pipeline::run_face_swap(cv::Mat &image,
         cv::Mat si_clone = swap_image.clone();
         cv::multiply(si_clone, cv::Scalar(1.f / 255.f, 1.f / 255.f, 1.f / 255.f), si_clone);
 
-        cv::Mat out_celeb_face, out_celeb_face_mask;
-        face2face *result = nullptr;
-
-        result = face_swap->run(si_clone);
-
-        face_swap->composite(image, face, &result, std::move(callback));
+        // The worker moves onto the next frame while the model runs; compositing continues from
+        // the completion callback.
+        face_swap->run_async(
+            si_clone,
+            [this, image, face, callback = std::move(callback)](face2face *result) mutable
+            {
+                if (result)
+                    face_swap->composite(image, face, &result, std::move(callback));
+                else
+                    callback(image);
+            });
     }
     else
     {
@@ -220,13 +342,25 @@ void face_pipeline::run_face_swap(cv::Mat &image,
     }
 }
 
-void face_pipeline::submit(cv::Mat &image)
+void face_pipeline::submit(frame &output)
 {
-    if (!output_queue.try_push(image))
+    output.trace.processed = std::chrono::steady_clock::now();
+
+    if (output.lossless)
     {
-        delete[] reinterpret_cast<uint8_t *>(image.data);
+        std::lock_guard<std::mutex> lock(reorder_mutex);
+
+        // Asynchronous face swaps complete out of order, so each lossless frame waits for the ones
+        // pushed before it
+        reorder_buffer.emplace(output.sequence, output);
+
+        for (auto it = reorder_buffer.begin();
+             it != reorder_buffer.end() && it->first == next_sequence_out;
+             it = reorder_buffer.erase(it), ++next_sequence_out)
+            output_queue.push(it->second);
     }
-    else
+
+    if (output.lossless || output_queue.try_push(output))
     {
         auto now = std::chrono::high_resolution_clock::now();
         size_t frame_interval_sample =
@@ -243,6 +377,8 @@ void face_pipeline::submit(cv::Mat &image)
                   << "%" << std::endl;
         frame_write_timestamp = now;
     }
+
+    --frames_in_flight;
 }
 
 // Shinji Umeyama, PAMI 1991, DOI: 10.1109/34.88573
@@ -2,6 +2,8 @@
 // Created by Shukant Pal on 5/21/23.
 //
 
+#include <iostream>
+
 #include "internal.h"
 
 namespace lens
@@ -9,8 +11,62 @@ namespace lens
 
 face_swap::face_swap() :
     gaussian_blur(gaussian_blur::build()),
-    face2face_pool()
-{ }
+    face2face_pool(),
+    inference_queue()
+{
+    inference_queue.set_capacity(MAX_INFERENCES_IN_FLIGHT);
+}
+
+face_swap::~face_swap() { stop_inference(); }
+
+void face_swap::stop_inference() noexcept
+{
+    if (inference_thread.joinable())
+    {
+        inference_queue.abort();
+        inference_thread.join();
+    }
+}
+
+void face_swap::run_async(cv::Mat &in_face, std::function<void(face2face *)> callback)
+{
+    // The thread is started lazily because run() cannot be dispatched until the backend is built
+    std::call_once(inference_thread_once,
+                   [this]() { inference_thread = std::thread(&face_swap::run_inference_queue, this); });
+
+    inference_queue.push({.in_face = std::move(in_face), .callback = std::move(callback)});
+}
+
+void face_swap::run_inference_queue()
+{
+    inference job;
+
+    try
+    {
+        while (true)
+        {
+            inference_queue.pop(job);
+
+            face2face *result = nullptr;
+
+            // A failed inference only loses its own face, so the thread keeps serving the rest
+            try
+            {
+                result = run(job.in_face);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "Failed to run face-swap inference: " << e.what() << std::endl;
+            }
+
+            job.callback(result);
+        }
+    }
+    catch (oneapi::tbb::user_abort &)
+    {
+        // The face swap is being destroyed
+    }
+}
 
 void face_swap::composite(cv::Mat &dst,
                           const face &extraction,
@@ -0,0 +1,77 @@
+#include "lens.h"
+
+#include <iostream>
+#include <string>
+
+namespace
+{
+
+std::vector<std::string> image_formats = {"jpg", "jpeg", "png", "gif", "bmp"};
+std::vector<std::string> video_formats = {"mp4", "mov", "avi", "mkv", "wmv"};
+
+bool match(const std::vector<std::string> &formats, const std::string &path)
+{
+    for (auto it = formats.begin(); it != formats.end(); ++it)
+        if (path.ends_with(*it))
+            return true;
+
+    return false;
+}
+
+bool load_image(const std::string &path, lens::face_pipeline &pipeline)
+{
+    cv::Mat image = cv::imread(path, cv::IMREAD_COLOR);
+
+    if (image.empty())
+    {
+        std::cout << "There was an error decoding the image " << path << std::endl;
+        return false;
+    }
+
+    lens::frame input = {.still = true, .source = path};
+    cv::cvtColor(image, input.image, cv::COLOR_BGR2BGRA);
+
+    pipeline << input;
+
+    return true;
+}
+
+} // namespace
+
+#ifdef LENS_FEATURE_FILE_IO
+bool load_video(const std::string &path, double speed, lens::face_pipeline &pipeline);
+#endif
+
+#ifdef __linux__
+bool load_camera(const std::string &path, int frame_rate, lens::face_pipeline &pipeline);
+#endif
+
+namespace lens
+{
+
+bool load(const std::string &path, int frame_rate, face_pipeline &pipeline, double speed)
+{
+#ifdef __linux__
+    if (path.empty() || path.starts_with("/dev/video"))
+        return load_camera(path.empty() ? "/dev/video0" : path, frame_rate, pipeline);
+#endif
+
+    if (std::filesystem::exists(path))
+    {
+        if (match(image_formats, path))
+            return load_image(path, pipeline);
+
+#ifdef LENS_FEATURE_FILE_IO
+        if (match(video_formats, path))
+            return load_video(path, speed, pipeline);
+#endif
+
+        std::cout << "Unknown file type" << std::endl;
+        return false;
+    }
+
+    std::cout << "Live capture is not supported on this platform" << std::endl;
+    return false;
+}
+
+} // namespace lens
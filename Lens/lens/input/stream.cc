@@ -0,0 +1,186 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include "lens.h"
+
+namespace
+{
+
+constexpr int PIPE_BUFFER_SIZE = 1 << 20;
+
+bool read_fully(int fd, void *buffer, size_t size)
+{
+    auto *cursor = static_cast<uint8_t *>(buffer);
+
+    while (size > 0)
+    {
+        ssize_t count = read(fd, cursor, size);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+
+        cursor += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+bool read_line(int fd, std::string &line)
+{
+    char character;
+    line.clear();
+
+    while (read_fully(fd, &character, 1))
+    {
+        if (character == '\n')
+            return true;
+
+        line.push_back(character);
+    }
+
+    return false;
+}
+
+struct y4m_header
+{
+    int width = 0;
+    int height = 0;
+    int frame_rate_num = 0;
+    int frame_rate_den = 1;
+    std::string colorspace = "420jpeg";
+};
+
+bool parse_y4m_header(const std::string &line, y4m_header &header)
+{
+    std::istringstream tokens(line);
+    std::string token;
+
+    tokens >> token;
+    if (token != "YUV4MPEG2")
+        return false;
+
+    while (tokens >> token)
+    {
+        const std::string value = token.substr(1);
+
+        switch (token[0])
+        {
+        case 'W':
+            header.width = std::stoi(value);
+            break;
+        case 'H':
+            header.height = std::stoi(value);
+            break;
+        case 'F':
+            std::sscanf(value.c_str(), "%d:%d", &header.frame_rate_num, &header.frame_rate_den);
+            break;
+        case 'C':
+            header.colorspace = value;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return header.width > 0 && header.height > 0;
+}
+
+/** Whether frames are 8-bit 4:2:0, whose variants only differ in where the chroma is sited. */
+bool is_8bit_420(const std::string &colorspace)
+{
+    return colorspace == "420" || colorspace == "420jpeg" || colorspace == "420paldv" ||
+           colorspace == "420mpeg2";
+}
+
+} // namespace
+
+namespace lens
+{
+
+bool load_stream(face_pipeline &pipeline, int frame_rate, cv::Size raw_size)
+{
+    const int fd = STDIN_FILENO;
+
+#ifdef F_SETPIPE_SZ
+    // Whole frames fit in the pipe, so the upstream process is not woken for every 64 KiB
+    fcntl(fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+
+    y4m_header header;
+    std::string line;
+
+    if (raw_size.empty())
+    {
+        if (!read_line(fd, line) || !parse_y4m_header(line, header))
+        {
+            std::cerr << "stdin is not a Y4M stream; pass its frame size to read raw BGRA"
+                      << std::endl;
+            return false;
+        }
+
+        if (!is_8bit_420(header.colorspace))
+        {
+            std::cerr << "Unsupported Y4M colorspace " << header.colorspace << std::endl;
+            return false;
+        }
+
+        // Chroma planes round odd sizes up, which the I420 conversion does not allow for
+        if (header.width % 2 != 0 || header.height % 2 != 0)
+        {
+            std::cerr << "Unsupported Y4M frame size " << header.width << "x" << header.height
+                      << "; the width and height must be even" << std::endl;
+            return false;
+        }
+    }
+    else
+    {
+        header.width = raw_size.width;
+        header.height = raw_size.height;
+        header.frame_rate_num = frame_rate;
+    }
+
+    const int64_t frame_rate_num = header.frame_rate_num > 0 ? header.frame_rate_num : frame_rate;
+    const int64_t frame_rate_den = header.frame_rate_num > 0 ? header.frame_rate_den : 1;
+    cv::Mat yuv_image(header.height * 3 / 2, header.width, CV_8UC1);
+
+    for (int64_t index = 0;; index++)
+    {
+        frame input = {
+            .pts = std::chrono::microseconds(index * 1000000 * frame_rate_den / frame_rate_num),
+            .frame_rate = rational{static_cast<int>(frame_rate_num),
+                                   static_cast<int>(frame_rate_den)},
+        };
+
+        if (raw_size.empty())
+        {
+            // Each frame follows a FRAME line, which may carry parameters that are ignored
+            if (!read_line(fd, line) || !line.starts_with("FRAME") ||
+                !read_fully(fd, yuv_image.data, yuv_image.total()))
+                break;
+
+            cv::cvtColor(yuv_image, input.image, cv::COLOR_YUV2BGRA_I420);
+        }
+        else
+        {
+            // Raw frames are read straight into the image the pipeline will process
+            input.image = cv::Mat(header.height, header.width, CV_8UC4);
+            if (!read_fully(fd, input.image.data, input.image.total() * input.image.elemSize()))
+                break;
+        }
+
+        pipeline.push(input);
+    }
+
+    return true;
+}
+
+} // namespace lens
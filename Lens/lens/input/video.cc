@@ -1,168 +1,455 @@
-#ifdef LENS_FEATURE_FILE_IO
-extern "C" {
 #define __STDC_CONSTANT_MACROS
 
-#include <libavutil/timestamp.h>
-#include <libavformat/avformat.h>
-#include <libavcodec/avcodec.h>
-#include <libswscale/swscale.h>
+extern "C" {
+#include <libavutil/buffer.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
+#include <libavutil/timestamp.h>
+#include <libswscale/swscale.h>
 }
-#endif
 
-#include "lens.h"
+#include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <string>
+#include <thread>
 
-bool load_video(const std::string &path, lens::face_pipeline &pipeline)
+#include "../async_io.h"
+#include "video.h"
+
+namespace
 {
-    AVFormatContext *format_ctx = nullptr;
 
-    if (avformat_open_input(&format_ctx, path.c_str(), NULL, NULL) < 0)
-        throw std::runtime_error("Failed to open input file");
+void av_print_error(const std::string &message, int av_code)
+{
+    constexpr int error_length = 100;
+    char error_description[error_length] = {0};
+    bool error_found = av_strerror(av_code, error_description, error_length) == 0;
+
+    std::cout << message << " (" << av_code << ", "
+              << (error_found ? error_description : "unknown error") << ")" << std::endl;
+}
+
+} // namespace
 
-    // Retrieve stream information
-    if (avformat_find_stream_info(format_ctx, NULL) < 0) {
-        printf("Could not find stream information.\n");
-        avformat_close_input(&format_ctx);
-        return 1;
+namespace lens
+{
+
+video_input::video_input(const std::string &path, double speed) :
+    format_ctx(nullptr),
+    input_io(nullptr),
+    codec_ctx(nullptr),
+    decoded_frame(nullptr),
+    image_scaler(nullptr),
+    detector_scaler(nullptr),
+    image_pool(nullptr),
+    image_pool_size(0),
+    detector_bgr(center_face::INPUT_HEIGHT, center_face::INPUT_WIDTH, CV_8UC3),
+    stream_index(-1),
+    frame_index(0),
+    warm_up_start(std::numeric_limits<int64_t>::min()),
+    range_start(std::numeric_limits<int64_t>::min()),
+    range_end(std::numeric_limits<int64_t>::max()),
+    range_ended(false),
+    speed(speed),
+    start_time(),
+    start_pts(0),
+    frames_dropped(0),
+    packet_queue(),
+    demux_stopped(false)
+{
+#ifdef LENS_FEATURE_ASYNC_IO
+    input_io = open_async_io(path, false);
+    if (input_io)
+    {
+        format_ctx = avformat_alloc_context();
+        format_ctx->pb = input_io;
+        format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
     }
+#endif
 
-    // Find the first video stream
-    int videoStreamIndex = -1;
-    for (int i = 0; i < format_ctx->nb_streams; i++) {
-        if (format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            videoStreamIndex = i;
-            break;
-        }
+    if (avformat_open_input(&format_ctx, path.c_str(), nullptr, nullptr) < 0)
+    {
+        close_input();
+        throw std::runtime_error("Failed to open input file");
     }
 
-    if (videoStreamIndex == -1) {
-        printf("Could not find a video stream.\n");
-        avformat_close_input(&format_ctx);
-        return 1;
+    if (avformat_find_stream_info(format_ctx, nullptr) < 0)
+    {
+        close_input();
+        throw std::runtime_error("Could not find stream information");
     }
 
-    // Retrieve the video codec parameters
-    AVCodecParameters *codecParams = format_ctx->streams[videoStreamIndex]->codecpar;
+    const AVCodec *codec = nullptr;
+    stream_index = av_find_best_stream(format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+
+    if (stream_index < 0 || !codec)
+    {
+        close_input();
+        throw std::runtime_error("Could not find a video stream with a suitable decoder");
+    }
 
-    // Find the video decoder
-    const AVCodec *codec = avcodec_find_decoder(codecParams->codec_id);
-    if (!codec) {
-        printf("Could not find a suitable video decoder.\n");
-        avformat_close_input(&format_ctx);
-        return 1;
+    codec_ctx = avcodec_alloc_context3(codec);
+    if (avcodec_parameters_to_context(codec_ctx, format_ctx->streams[stream_index]->codecpar) < 0)
+    {
+        avcodec_free_context(&codec_ctx);
+        close_input();
+        throw std::runtime_error("Failed to initialize the video codec context");
     }
 
-    // Initialize the codec format_ctx
-    AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
-    if (avcodec_parameters_to_context(codec_ctx, codecParams) < 0) {
-        printf("Failed to initialize the codec format_ctx.\n");
+    // Let the decoder size its own thread pool; frame threading pipelines whole frames across
+    // cores, slice threading covers streams that were not encoded with frame threading in mind.
+    codec_ctx->thread_count = 0;
+    codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    if (avcodec_open2(codec_ctx, codec, nullptr) < 0)
+    {
         avcodec_free_context(&codec_ctx);
-        avformat_close_input(&format_ctx);
-        return 1;
+        close_input();
+        throw std::runtime_error("Failed to open the video codec");
     }
 
-    // Open the codec
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-        printf("Failed to open the video codec.\n");
+    decoded_frame = av_frame_alloc();
+    if (!decoded_frame)
+    {
         avcodec_free_context(&codec_ctx);
-        avformat_close_input(&format_ctx);
-        return 1;
+        close_input();
+        throw std::runtime_error("Failed to initialize frame");
     }
 
-    int frame_index = 0;
-
-    // Read each frame
-    AVPacket packet;
-    while (av_read_frame(format_ctx, &packet) >= 0) {
-        // Process only video packets
-        if (packet.stream_index == videoStreamIndex) {
-            // Send packet to the decoder
-            if (avcodec_send_packet(codec_ctx, &packet) < 0) {
-                printf("Failed to send a packet to the decoder.\n");
-                av_packet_unref(&packet);
-                continue;
-            }
-
-            AVFrame *frame = av_frame_alloc();
-
-            // Receive decoded frame from the decoder
-            int ret = avcodec_receive_frame(codec_ctx, frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                std::cerr << "Dropping frame" << std::endl;
-                av_frame_free(&frame);
-                av_packet_unref(&packet);
-                continue;
-            } else if (ret < 0) {
-                printf("Error while receiving a frame from the decoder.\n");
-                av_frame_free(&frame);
-                av_packet_unref(&packet);
+    packet_queue.set_capacity(PACKET_QUEUE_CAPACITY);
+}
+
+video_input::~video_input() noexcept
+{
+    stop_demux();
+    sws_freeContext(image_scaler);
+    sws_freeContext(detector_scaler);
+    av_buffer_pool_uninit(&image_pool);
+    av_frame_free(&decoded_frame);
+    avcodec_free_context(&codec_ctx);
+    close_input();
+}
+
+std::vector<int64_t> video_input::keyframes()
+{
+    std::vector<int64_t> timestamps;
+    AVPacket *packet = av_packet_alloc();
+
+    while (av_read_frame(format_ctx, packet) >= 0)
+    {
+        if (packet->stream_index == stream_index && (packet->flags & AV_PKT_FLAG_KEY))
+            timestamps.push_back(packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts);
+
+        av_packet_unref(packet);
+    }
+
+    av_packet_free(&packet);
+
+    return timestamps;
+}
+
+int64_t video_input::frame_duration() const
+{
+    const AVStream *stream = format_ctx->streams[stream_index];
+    const AVRational frame_rate =
+        stream->avg_frame_rate.num > 0 ? stream->avg_frame_rate : AVRational{30, 1};
+
+    return std::max<int64_t>(av_rescale_q(1, av_inv_q(frame_rate), stream->time_base), 1);
+}
+
+void video_input::set_range(int64_t warm_up_start, int64_t start, int64_t end)
+{
+    this->warm_up_start = warm_up_start;
+    this->range_start = start;
+    this->range_end = end;
+}
+
+void video_input::run(face_pipeline &pipeline)
+{
+    if (warm_up_start != std::numeric_limits<int64_t>::min())
+        av_seek_frame(format_ctx, stream_index, warm_up_start, AVSEEK_FLAG_BACKWARD);
+
+    demux_thread = std::thread(&video_input::demux, this);
+
+    AVPacket *packet = nullptr;
+
+    while (true)
+    {
+        packet_queue.pop(packet);
+
+        // A null packet marks the end of the stream, and flushes frames buffered by the decoder
+        int send_code = avcodec_send_packet(codec_ctx, packet);
+
+        while (send_code == AVERROR(EAGAIN))
+        {
+            int receive_code = receive_frames(pipeline);
+            if (receive_code < 0 && receive_code != AVERROR(EAGAIN))
                 break;
-            }
-
-            // Convert the frame to RGBA format
-            AVFrame* rgbaFrame = av_frame_alloc();
-            if (!rgbaFrame) {
-                std::cerr << "Failed to allocate RGBA frame" << std::endl;
-                avcodec_free_context(&codec_ctx);
-                avformat_close_input(&format_ctx);
-                return true;
-            }
-
-            std::cout << "FRAME INDEX" << frame_index << std::endl;
-
-            int bufferSize = av_image_get_buffer_size(AV_PIX_FMT_RGBA,
-                                                      codec_ctx->width,
-                                                      codec_ctx->height,
-                                                      1);
-            auto* buffer = new uint8_t[bufferSize];
-
-            av_image_fill_arrays(rgbaFrame->data, rgbaFrame->linesize,
-                                 buffer, AV_PIX_FMT_RGBA,
-                                 codec_ctx->width, codec_ctx->height, 1);
-
-            struct SwsContext* swsContext = sws_getContext(codec_ctx->width,
-                                                           codec_ctx->height,
-                                                           codec_ctx->pix_fmt,
-                                                           codec_ctx->width,
-                                                           codec_ctx->height,
-                                                           AV_PIX_FMT_BGRA,
-                                                           SWS_BILINEAR,
-                                                           nullptr,
-                                                           nullptr,
-                                                           nullptr);
-
-            if (!swsContext) {
-                std::cerr << "Failed to create SwsContext" << std::endl;
-                av_free(buffer);
-                av_frame_free(&rgbaFrame);
-                avcodec_free_context(&codec_ctx);
-                avformat_close_input(&format_ctx);
-                return true;
-            }
-
-            sws_scale(swsContext, frame->data, frame->linesize,
-                      0, codec_ctx->height,
-                      rgbaFrame->data, rgbaFrame->linesize);
-
-            cv::Mat image(static_cast<int>(codec_ctx->height), static_cast<int>(codec_ctx->width), CV_8UC4, buffer);
-            pipeline << image;
-
-            std::this_thread::sleep_for(frame_index < 8 ? std::chrono::milliseconds(500) : std::chrono::milliseconds(100));
-            frame_index++;
-
-            av_frame_free(&frame);
+
+            send_code = avcodec_send_packet(codec_ctx, packet);
+        }
+
+        if (range_ended)
+        {
+            av_packet_free(&packet);
+            break;
         }
 
-        av_packet_unref(&packet);
+        if (send_code < 0 && send_code != AVERROR_EOF)
+            av_print_error("Failed to send a packet to the decoder", send_code);
+
+        const bool end_of_stream = packet == nullptr;
+        av_packet_free(&packet);
+
+        int receive_code = receive_frames(pipeline);
+
+        if (end_of_stream || range_ended || receive_code == AVERROR_EOF)
+            break;
+        if (receive_code < 0 && receive_code != AVERROR(EAGAIN))
+        {
+            av_print_error("Error while receiving a frame from the decoder", receive_code);
+            break;
+        }
     }
 
-    // Close the codec
-    avcodec_free_context(&codec_ctx);
+    stop_demux();
+
+    if (frames_dropped > 0)
+        std::cout << "Dropped " << frames_dropped << " late frames of " << frame_index << std::endl;
+}
 
-    // Close the video file
+void video_input::close_input()
+{
+    // FFmpeg leaves custom I/O to whoever opened it
     avformat_close_input(&format_ctx);
+#ifdef LENS_FEATURE_ASYNC_IO
+    close_async_io(&input_io);
+#endif
+}
+
+void video_input::demux()
+{
+    while (!demux_stopped)
+    {
+        AVPacket *packet = av_packet_alloc();
+        int read_code = av_read_frame(format_ctx, packet);
+
+        if (read_code < 0)
+        {
+            av_packet_free(&packet);
+
+            if (read_code != AVERROR_EOF)
+                av_print_error("Failed to read a packet", read_code);
+
+            packet_queue.push(nullptr);
+            break;
+        }
+
+        if (packet->stream_index != stream_index)
+        {
+            av_packet_free(&packet);
+            continue;
+        }
+
+        packet_queue.push(packet);
+    }
+}
+
+void video_input::stop_demux()
+{
+    AVPacket *packet = nullptr;
+
+    demux_stopped = true;
+
+    // Draining makes room for the packet the demuxer may be pushing, after which it sees the flag
+    while (packet_queue.try_pop(packet))
+        av_packet_free(&packet);
+
+    if (demux_thread.joinable())
+        demux_thread.join();
+
+    while (packet_queue.try_pop(packet))
+        av_packet_free(&packet);
+}
+
+int video_input::receive_frames(face_pipeline &pipeline)
+{
+    int receive_code;
+
+    while ((receive_code = avcodec_receive_frame(codec_ctx, decoded_frame)) >= 0)
+    {
+        const int64_t timestamp = decoded_frame->best_effort_timestamp;
+
+        if (timestamp != AV_NOPTS_VALUE && timestamp >= range_end)
+        {
+            range_ended = true;
+            av_frame_unref(decoded_frame);
+            return AVERROR_EOF;
+        }
+
+        if (timestamp != AV_NOPTS_VALUE && timestamp < warm_up_start)
+        {
+            // Decoded only as a reference for the frames after the seek point
+        }
+        else if (wait_until_due())
+            present(pipeline, timestamp != AV_NOPTS_VALUE && timestamp < range_start);
+        else
+            ++frames_dropped;
+
+        ++frame_index;
+        av_frame_unref(decoded_frame);
+    }
+
+    return receive_code;
+}
+
+bool video_input::wait_until_due()
+{
+    if (speed <= 0)
+        return true;
+
+    const AVStream *stream = format_ctx->streams[stream_index];
+    double pts;
+
+    if (decoded_frame->best_effort_timestamp != AV_NOPTS_VALUE)
+        pts = static_cast<double>(decoded_frame->best_effort_timestamp) * av_q2d(stream->time_base);
+    else if (stream->avg_frame_rate.num > 0)
+        pts = static_cast<double>(frame_index) / av_q2d(stream->avg_frame_rate);
+    else
+        return true;
+
+    const auto now = std::chrono::steady_clock::now();
+
+    if (frame_index == 0)
+    {
+        start_time = now;
+        start_pts = pts;
+    }
+
+    const auto due = start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                      std::chrono::duration<double>((pts - start_pts) / speed));
+
+    if (now > due + LATE_FRAME_THRESHOLD)
+        return false;
+
+    std::this_thread::sleep_until(due);
+    return true;
+}
+
+void video_input::present(face_pipeline &pipeline, bool warm_up)
+{
+    const int width = decoded_frame->width;
+    const int height = decoded_frame->height;
+    const auto format = static_cast<AVPixelFormat>(decoded_frame->format);
+    const cv::Size size = pipeline.ingest_size(cv::Size(width, height));
+    const auto decoded = std::chrono::steady_clock::now();
+
+    // Both scalers read the decoded frame directly, so the detector input never goes through an
+    // intermediate full-resolution BGRA resize, and the image is scaled to the outputs' size in
+    // the same pass as its conversion. They are only rebuilt if the geometry changes.
+    image_scaler = sws_getCachedContext(image_scaler,
+                                        width,
+                                        height,
+                                        format,
+                                        size.width,
+                                        size.height,
+                                        AV_PIX_FMT_BGRA,
+                                        SWS_BILINEAR,
+                                        nullptr,
+                                        nullptr,
+                                        nullptr);
+    detector_scaler = sws_getCachedContext(detector_scaler,
+                                           width,
+                                           height,
+                                           format,
+                                           center_face::INPUT_WIDTH,
+                                           center_face::INPUT_HEIGHT,
+                                           AV_PIX_FMT_BGR24,
+                                           SWS_BILINEAR,
+                                           nullptr,
+                                           nullptr,
+                                           nullptr);
+
+    if (!image_scaler || !detector_scaler)
+    {
+        std::cerr << "Failed to create SwsContext" << std::endl;
+        return;
+    }
+
+    // Images are views of pooled buffers, which return to the pool once the pipeline and its
+    // outputs have released every copy of the Mat
+    const int image_step = size.width * 4;
+    const size_t image_size = static_cast<size_t>(image_step) * size.height;
+
+    if (!image_pool || image_pool_size != image_size)
+    {
+        av_buffer_pool_uninit(&image_pool);
+        image_pool = av_buffer_pool_init(image_size, nullptr);
+        image_pool_size = image_size;
+    }
+
+    AVBufferRef *image_buffer = av_buffer_pool_get(image_pool);
+    if (!image_buffer)
+    {
+        std::cerr << "Failed to allocate a frame buffer" << std::endl;
+        return;
+    }
+
+    frame input = {
+        .image = wrap_buffer(size.height,
+                             size.width,
+                             CV_8UC4,
+                             image_buffer->data,
+                             image_step,
+                             [image_buffer]() mutable { av_buffer_unref(&image_buffer); }),
+        .warm_up = warm_up,
+        .trace = {.captured = decoded},
+    };
+
+    if (decoded_frame->best_effort_timestamp != AV_NOPTS_VALUE)
+        input.pts = std::chrono::microseconds(
+            av_rescale_q(decoded_frame->best_effort_timestamp,
+                         format_ctx->streams[stream_index]->time_base,
+                         AVRational{1, 1000000}));
+
+    const AVRational frame_rate = format_ctx->streams[stream_index]->avg_frame_rate;
+    if (frame_rate.num > 0 && frame_rate.den > 0)
+        input.frame_rate = rational{frame_rate.num, frame_rate.den};
+
+    uint8_t *image_data[4] = {input.image.data};
+    int image_linesize[4] = {static_cast<int>(input.image.step)};
+    sws_scale(image_scaler,
+              decoded_frame->data,
+              decoded_frame->linesize,
+              0,
+              height,
+              image_data,
+              image_linesize);
+
+    uint8_t *detector_data[4] = {detector_bgr.data};
+    int detector_linesize[4] = {static_cast<int>(detector_bgr.step)};
+    sws_scale(detector_scaler,
+              decoded_frame->data,
+              decoded_frame->linesize,
+              0,
+              height,
+              detector_data,
+              detector_linesize);
+    detector_bgr.convertTo(input.detector_image, CV_32FC3);
+
+    if (speed > 0)
+        pipeline << input;
+    else
+        pipeline.push(input);
+}
+
+} // namespace lens
+
+bool load_video(const std::string &path, double speed, lens::face_pipeline &pipeline)
+{
+    lens::video_input input(path, speed);
+    input.run(pipeline);
 
     return true;
-}
\ No newline at end of file
+}
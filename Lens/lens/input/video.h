@@ -0,0 +1,94 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+
+#include <atomic>
+#include <chrono>
+#include <oneapi/tbb.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "internal.h"
+#include "lens.h"
+
+namespace lens
+{
+
+/**
+ * Decodes the first video stream of a media file into the face pipeline. Packets are demuxed
+ * ahead of the decoder on their own thread, and the decoder runs frame- or slice-threaded. Each
+ * decoded frame is scaled once into the full-resolution BGRA image and once into the CenterFace
+ * input, with both scalers cached for the stream's geometry. Images are written straight into
+ * pooled, reference-counted buffers that the pipeline holds views of.
+ *
+ * Frames are presented when their timestamp comes due on a steady clock, scaled by the playback
+ * speed. Frames that are already late are dropped before they are scaled. With a speed of zero,
+ * frames are pushed as fast as the pipeline accepts them and none are dropped.
+ */
+class video_input
+{
+  public:
+    video_input(const std::string &path, double speed);
+    ~video_input() noexcept;
+
+    /** Decode the whole stream into the pipeline, returning once the decoder is flushed. */
+    void run(face_pipeline &pipeline);
+
+    /**
+     * Read through the stream for the timestamps of its keyframes, in the stream's time base. This
+     * consumes the input, so it cannot be run afterwards.
+     */
+    std::vector<int64_t> keyframes();
+    /** The nominal duration of one frame, in the stream's time base. */
+    int64_t frame_duration() const;
+
+    /**
+     * Limit run() to frames timestamped in [start, end), in the stream's time base. Frames from
+     * warm_up_start onwards are pushed before them as warm-up frames to seed face tracking.
+     */
+    void set_range(int64_t warm_up_start, int64_t start, int64_t end);
+
+  private:
+    static constexpr int PACKET_QUEUE_CAPACITY = 64;
+    static constexpr std::chrono::milliseconds LATE_FRAME_THRESHOLD{40};
+
+    AVFormatContext *format_ctx;
+    AVIOContext *input_io;
+    AVCodecContext *codec_ctx;
+    AVFrame *decoded_frame;
+    SwsContext *image_scaler;
+    SwsContext *detector_scaler;
+    AVBufferPool *image_pool;
+    size_t image_pool_size;
+    cv::Mat detector_bgr;
+    int stream_index;
+    size_t frame_index;
+
+    int64_t warm_up_start;
+    int64_t range_start;
+    int64_t range_end;
+    bool range_ended;
+
+    double speed;
+    std::chrono::steady_clock::time_point start_time;
+    double start_pts;
+    size_t frames_dropped;
+
+    oneapi::tbb::concurrent_bounded_queue<AVPacket *> packet_queue;
+    std::atomic<bool> demux_stopped;
+    std::thread demux_thread;
+
+    void close_input();
+    void demux();
+    void stop_demux();
+    int receive_frames(face_pipeline &pipeline);
+    bool wait_until_due();
+    void present(face_pipeline &pipeline, bool warm_up);
+};
+
+} // namespace lens
@@ -1,7 +1,9 @@
 #include "facade.h"
 #include "lens.h"
 #include "output/base_output.h"
+#include <algorithm>
 #include <boost/program_options.hpp>
+#include <cstdio>
 #include <iostream>
 #include <opencv2/opencv.hpp>
 #include <thread>
@@ -10,14 +12,49 @@ namespace po = boost::program_options;
 
 int main(int argc, char **argv)
 {
-    std::cout << "Lens is starting..." << std::endl;
-
     po::options_description options("Options");
-    options.add_options()("dst", po::value<std::string>(), "The name of the video output device")(
+    options.add_options()(
+        "dst",
+        po::value<std::vector<std::string>>(),
+        "The name of the video output device. Repeat it to output the same frames to several.")(
         "src", po::value<std::string>(), "The name of the video input device")(
+        "src-size",
+        po::value<std::string>(),
+        "The WIDTHxHEIGHT of raw BGRA frames on stdin with --src=-, which otherwise reads Y4M.")(
+        "dst-format", po::value<std::string>(), "The framing of video on stdout: y4m or bgra.")(
+        "dst-policy",
+        po::value<std::vector<std::string>>(),
+        "What the dst does when it falls behind: block, drop-oldest or latest. Repeat it to give "
+        "each dst its own, in order.")(
         "frame-rate", po::value<int>(), "The frame rate at which the src should be processed.")(
+        "speed",
+        po::value<double>(),
+        "The playback speed of a video src, or 0 to process it as fast as possible.")(
+        "skip-existing",
+        po::bool_switch(),
+        "Skip images in a batch src whose output already exists in the dst directory.")(
+        "segments",
+        po::value<int>(),
+        "Process a video src to a video dst as this many segments in parallel.")(
+        "preset", po::value<std::string>(), "The x264 preset for video file outputs.")(
+        "tune", po::value<std::string>(), "The x264 tuning for video file outputs.")(
+        "crf", po::value<int>(), "The constant rate factor for video file outputs.")(
+        "bitrate", po::value<int64_t>(), "The bit rate for video file outputs, instead of a CRF.")(
+        "gop", po::value<int>(), "The keyframe interval for video file outputs, in frames.")(
+        "encoder-threads", po::value<int>(), "The encoder threads for video file outputs.")(
+        "fragment-duration",
+        po::value<double>(),
+        "Write MP4 fragments, or .m3u8 chunks, of this many seconds.")(
+        "segment-format", po::value<std::string>(), "The container of .m3u8 chunks: mpegts or mp4.")(
+        "device-queue-depth",
+        po::value<int>(),
+        "The frames a Facade device dst may hold before lens keeps only the newest.")(
         "face-swap-model", po::value<std::string>(), "The face swap model to use.")(
-        "root-dir", po::value<std::string>(), "The directory in which ML models are stored");
+        "root-dir", po::value<std::string>(), "The directory in which ML models are stored")(
+        "backend", po::value<std::string>(), "The inference backend to run all models on.")(
+        "center-face-backend", po::value<std::string>(), "The inference backend for CenterFace.")(
+        "face-mesh-backend", po::value<std::string>(), "The inference backend for FaceMesh.")(
+        "face-swap-backend", po::value<std::string>(), "The inference backend for face swap.");
 
     po::variables_map vm;
 
@@ -33,7 +70,16 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    if (!vm.contains("dst"))
+    const std::vector<std::string> dsts =
+        vm.contains("dst") ? vm["dst"].as<std::vector<std::string>>() : std::vector<std::string>();
+
+    // Video written to stdout must not be interleaved with logs
+    if (std::ranges::count(dsts, "-") > 0)
+        std::cout.rdbuf(std::cerr.rdbuf());
+
+    std::cout << "Lens is starting..." << std::endl;
+
+    if (dsts.empty())
     {
         std::cerr << "No --dst provided" << std::endl;
         return -2;
@@ -50,7 +96,7 @@ int main(int argc, char **argv)
     }
 
     std::string src = vm.contains("src") ? vm["src"].as<std::string>() : "";
-    std::string dst = vm["dst"].as<std::string>();
+    std::string dst = dsts.front();
     std::string root_dir = vm["root-dir"].as<std::string>();
     std::string face_swap_model = vm["face-swap-model"].as<std::string>();
     int frame_rate = vm.contains("frame-rate") ? vm["frame-rate"].as<int>() : 30;
@@ -61,20 +107,224 @@ int main(int argc, char **argv)
         return -4;
     }
 
+    double speed = vm.contains("speed") ? vm["speed"].as<double>() : 1;
+
+    if (speed < 0)
+    {
+        std::cerr << "Unsupported speed " << speed << std::endl;
+        return -4;
+    }
+
+    std::string backend = vm.contains("backend") ? vm["backend"].as<std::string>() : "";
+    lens::face_pipeline_backends backends = {
+        .center_face = vm.contains("center-face-backend")
+                           ? vm["center-face-backend"].as<std::string>()
+                           : backend,
+        .face_mesh =
+            vm.contains("face-mesh-backend") ? vm["face-mesh-backend"].as<std::string>() : backend,
+        .face_swap =
+            vm.contains("face-swap-backend") ? vm["face-swap-backend"].as<std::string>() : backend,
+    };
+
+    std::cout << "Inference backends available:";
+    for (const auto &available : lens::backends())
+        std::cout << " " << available.name;
+    std::cout << std::endl;
+
+    lens::encoder_options encoder;
+    encoder.frame_rate = frame_rate;
+    if (vm.contains("preset"))
+        encoder.preset = vm["preset"].as<std::string>();
+    if (vm.contains("tune"))
+        encoder.tune = vm["tune"].as<std::string>();
+    if (vm.contains("crf"))
+        encoder.crf = vm["crf"].as<int>();
+    if (vm.contains("bitrate"))
+        encoder.bit_rate = vm["bitrate"].as<int64_t>();
+    if (vm.contains("gop"))
+        encoder.gop_size = vm["gop"].as<int>();
+    if (vm.contains("encoder-threads"))
+        encoder.threads = vm["encoder-threads"].as<int>();
+    if (vm.contains("fragment-duration"))
+        encoder.fragment_duration = vm["fragment-duration"].as<double>();
+    if (vm.contains("segment-format"))
+        encoder.segment_format = vm["segment-format"].as<std::string>();
+    if (vm.contains("device-queue-depth"))
+        encoder.device_queue_depth = vm["device-queue-depth"].as<int>();
+    if (vm.contains("dst-format"))
+    {
+        const std::string dst_format = vm["dst-format"].as<std::string>();
+
+        if (dst_format == "y4m")
+            encoder.stream = lens::stream_format::y4m;
+        else if (dst_format == "bgra")
+            encoder.stream = lens::stream_format::bgra;
+        else
+        {
+            std::cerr << "Unsupported dst-format " << dst_format << std::endl;
+            return -4;
+        }
+    }
+
+    // One policy applies to every dst; otherwise each dst takes the policy in the same position
+    std::vector<lens::output_policy> dst_policies;
+    if (vm.contains("dst-policy"))
+    {
+        for (const std::string &policy : vm["dst-policy"].as<std::vector<std::string>>())
+        {
+            if (policy == "block")
+                dst_policies.push_back(lens::output_policy::block);
+            else if (policy == "drop-oldest")
+                dst_policies.push_back(lens::output_policy::drop_oldest);
+            else if (policy == "latest")
+                dst_policies.push_back(lens::output_policy::latest_only);
+            else
+            {
+                std::cerr << "Unsupported dst-policy " << policy << std::endl;
+                return -4;
+            }
+        }
+
+        if (dst_policies.size() != 1 && dst_policies.size() != dsts.size())
+        {
+            std::cerr << "Give one --dst-policy, or one for each --dst" << std::endl;
+            return -4;
+        }
+    }
+
+    cv::Size src_size;
+    if (vm.contains("src-size") &&
+        std::sscanf(vm["src-size"].as<std::string>().c_str(),
+                    "%dx%d",
+                    &src_size.width,
+                    &src_size.height) != 2)
+    {
+        std::cerr << "Unsupported src-size " << vm["src-size"].as<std::string>() << std::endl;
+        return -4;
+    }
+
+    int segments = vm.contains("segments") ? vm["segments"].as<int>() : 1;
+
+    if (segments < 1)
+    {
+        std::cerr << "Unsupported segments " << segments << std::endl;
+        return -4;
+    }
+
+    if ((lens::is_batch(src) || segments > 1) && dsts.size() > 1)
+    {
+        std::cerr << "Batches and segmented videos take a single --dst" << std::endl;
+        return -4;
+    }
+
+    // Segments are joined by copying their packets into one file, which neither a playlist nor a
+    // fragmented file survives
+    if (segments > 1 && (dst.ends_with(".m3u8") || encoder.fragment_duration > 0))
+    {
+        std::cerr << "Segmented videos cannot be written as .m3u8 chunks or MP4 fragments"
+                  << std::endl;
+        return -4;
+    }
+
+    if (lens::is_batch(src))
+    {
+        try
+        {
+            auto models = lens::face_pipeline_models::build(
+                root_dir, std::filesystem::path(face_swap_model), backends);
+
+            return lens::batch(src, dst, vm["skip-existing"].as<bool>(), models) ? 0 : -6;
+        }
+        catch (std::exception &e)
+        {
+            std::cout << e.what() << std::endl;
+            return -6;
+        }
+    }
+
+#ifdef LENS_FEATURE_FILE_IO
+    if (segments > 1)
+    {
+        try
+        {
+            auto models = lens::face_pipeline_models::build(
+                root_dir, std::filesystem::path(face_swap_model), backends);
+
+            return lens::transcode(src, dst, segments, models, encoder) ? 0 : -6;
+        }
+        catch (std::exception &e)
+        {
+            std::cout << e.what() << std::endl;
+            return -6;
+        }
+    }
+#endif
+
     std::cout << "Starting face pipeline!" << std::endl;
 
     try
     {
-        lens::face_pipeline pipeline(root_dir, std::filesystem::path(face_swap_model));
-        std::unique_ptr<lens::base_output> output = lens::output(pipeline, dst, false);
+        lens::face_pipeline pipeline(root_dir, std::filesystem::path(face_swap_model), backends);
+        std::vector<std::unique_ptr<lens::base_output>> outputs;
+        cv::Size target_size;
+        bool keep_source_size = false;
+
+        for (size_t i = 0; i < dsts.size(); i++)
+        {
+            std::string output_dst = dsts[i];
+            std::unique_ptr<lens::base_output> output =
+                lens::output(pipeline, output_dst, false, encoder);
+
+            if (!output)
+            {
+                std::cerr << "Unsupported --dst " << output_dst << std::endl;
+                return -5;
+            }
+            if (!dst_policies.empty())
+                output->set_policy(dst_policies[dst_policies.size() == 1 ? 0 : i]);
+
+            // Frames must stay large enough for the largest output, and whole for any that scales
+            const cv::Size size = output->target_size();
 
-        if (!lens::load(src, frame_rate, pipeline))
+            if (size.empty())
+                keep_source_size = true;
+            target_size.width = std::max(target_size.width, size.width);
+            target_size.height = std::max(target_size.height, size.height);
+
+            outputs.push_back(std::move(output));
+        }
+
+        // Scale frames once as they come in, rather than carrying pixels no output will show
+        pipeline.fit_to(keep_source_size ? cv::Size() : target_size);
+
+        const bool loaded = src == "-" ? lens::load_stream(pipeline, frame_rate, src_size)
+                                       : lens::load(src, frame_rate, pipeline, speed);
+
+        if (!loaded)
         {
             std::cout << "Failed to locate source file or device" << std::endl;
         }
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-//        std::exit(0);
+        pipeline.close();
+
+        for (auto &output : outputs)
+            output->join();
+
+        for (size_t i = 0; i < outputs.size(); i++)
+        {
+            const lens::output_stats stats = outputs[i]->stats();
+            std::cout << dsts[i] << ": output=" << stats.handled << "/" << stats.received
+                      << " frames | "
+                      << "dropped=" << stats.dropped << " | "
+                      << "latency_mean=" << stats.latency_mean.count() / 1000.0 << "ms | "
+                      << "latency_max=" << stats.latency_max.count() / 1000.0 << "ms | "
+                      << "glass_to_glass_p50=" << stats.glass_to_glass_p50.count() / 1000.0
+                      << "ms | "
+                      << "glass_to_glass_p90=" << stats.glass_to_glass_p90.count() / 1000.0
+                      << "ms | "
+                      << "glass_to_glass_p99=" << stats.glass_to_glass_p99.count() / 1000.0 << "ms"
+                      << std::endl;
+        }
     }
     catch (std::exception &e)
     {
@@ -2,6 +2,7 @@
 // Created by Shukant Pal on 6/1/23.
 //
 
+#include <algorithm>
 #include <oneapi/tbb.h>
 
 #include "base_output.h"
@@ -11,29 +12,189 @@ namespace fs = std::filesystem;
 namespace lens
 {
 
-base_output::base_output(face_pipeline &pipeline) :
+base_output::base_output(face_pipeline &pipeline, output_policy policy, size_t capacity) :
     pipeline(pipeline),
-    pipe_thread(&base_output::pipe, this)
-{ }
+    policy(policy),
+    received_count(0),
+    handled_count(0),
+    dropped_count(0),
+    latency_total(0),
+    latency_max(0),
+    glass_to_glass_next(0)
+{
+    mailbox.set_capacity(static_cast<std::ptrdiff_t>(std::max<size_t>(1, capacity)));
+    handle_thread = std::thread(&base_output::deliver, this);
+
+    std::lock_guard<std::mutex> lock(pipeline.outputs_mutex);
+    pipeline.outputs.push_back(this);
+
+    if (pipeline.outputs.size() == 1)
+        pipe_thread = std::thread(&base_output::pipe, this);
+}
 
-base_output::~base_output() noexcept
+base_output::~base_output() noexcept { stop(); }
+
+void base_output::join()
 {
-    pipe_thread.detach();
+    if (pipe_thread.joinable())
+        pipe_thread.join();
+    if (handle_thread.joinable())
+        handle_thread.join();
+}
+
+void base_output::stop() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(pipeline.outputs_mutex);
+        std::erase(pipeline.outputs, this);
+    }
+
+    // The pipe only ends once the pipeline is drained, handing its last frames to other outputs
+    if (pipe_thread.joinable())
+    {
+        pipeline.close();
+        pipe_thread.join();
+    }
+
+    // Nothing is offered to an output once it is no longer listed, so this is its last frame
+    if (handle_thread.joinable())
+    {
+        mailbox.push({});
+        handle_thread.join();
+    }
 }
 
-bool base_output::handle(cv::Mat &image) { return false; }
+void base_output::set_policy(output_policy policy) { this->policy = policy; }
 
-[[noreturn]] void base_output::pipe()
+output_stats base_output::stats() const
 {
-    cv::Mat image;
+    const size_t handled = handled_count;
+    std::vector<int64_t> latencies;
+
+    {
+        std::lock_guard<std::mutex> lock(glass_to_glass_mutex);
+        latencies = glass_to_glass;
+    }
+
+    auto percentile = [&latencies](size_t percent)
+    {
+        if (latencies.empty())
+            return std::chrono::microseconds(0);
+
+        const auto nth = latencies.begin() + (latencies.size() - 1) * percent / 100;
+        std::nth_element(latencies.begin(), nth, latencies.end());
+        return std::chrono::microseconds(*nth);
+    };
+
+    return {
+        .received = received_count,
+        .handled = handled,
+        .dropped = dropped_count,
+        .latency_mean = std::chrono::microseconds(handled ? latency_total / handled : 0),
+        .latency_max = std::chrono::microseconds(latency_max),
+        .glass_to_glass_p50 = percentile(50),
+        .glass_to_glass_p90 = percentile(90),
+        .glass_to_glass_p99 = percentile(99),
+    };
+}
+
+cv::Size base_output::target_size() const { return {}; }
+
+bool base_output::handle(frame &output) { return false; }
+
+void base_output::pipe()
+{
+    frame output;
 
     while (true)
     {
-        pipeline >> image;
+        pipeline >> output;
+        output.trace.dispatched = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(pipeline.outputs_mutex);
+
+        // The empty frame is never dropped, since nothing is offered after it
+        for (base_output *target : pipeline.outputs)
+            if (output.image.empty())
+                target->mailbox.push({});
+            else
+                target->offer(output, pipeline.outputs.size() == 1);
+
+        if (output.image.empty())
+            break;
+    }
+}
+
+void base_output::offer(const frame &output, bool exclusive)
+{
+    frame item = output;
+    frame stale;
+    output_policy mode = policy;
+    ++received_count;
+
+    // Waiting on one output would hold up every other output of the pipeline
+    if (mode == output_policy::block && !exclusive)
+        mode = output_policy::drop_oldest;
+
+    switch (mode)
+    {
+    case output_policy::block:
+        mailbox.push(std::move(item));
+        break;
+    case output_policy::drop_oldest:
+        while (!mailbox.try_push(item))
+            if (mailbox.try_pop(stale))
+                ++dropped_count;
+        break;
+    case output_policy::latest_only:
+        while (mailbox.try_pop(stale))
+            ++dropped_count;
+        mailbox.push(std::move(item));
+        break;
+    }
+}
+
+void base_output::deliver()
+{
+    frame item;
+
+    while (true)
+    {
+        mailbox.pop(item);
+
+        if (item.image.empty())
+            break;
+
+        if (!handle(item))
+        {
+            ++dropped_count;
+            continue;
+        }
+
+        frame_trace &trace = item.trace;
+        trace.presented = std::chrono::steady_clock::now();
+
+        const int64_t latency =
+            std::chrono::duration_cast<std::chrono::microseconds>(trace.presented - trace.dispatched)
+                .count();
+        const int64_t glass_latency =
+            std::chrono::duration_cast<std::chrono::microseconds>(trace.presented - trace.captured)
+                .count();
+        int64_t longest = latency_max;
+
+        ++handled_count;
+        latency_total += latency;
+        while (latency > longest && !latency_max.compare_exchange_weak(longest, latency))
+            ;
+
+        std::lock_guard<std::mutex> lock(glass_to_glass_mutex);
 
-        if (!handle(image))
-            buffer_queue.push(image);
+        if (glass_to_glass.size() < LATENCY_SAMPLES)
+            glass_to_glass.push_back(glass_latency);
+        else
+            glass_to_glass[glass_to_glass_next] = glass_latency;
+        glass_to_glass_next = (glass_to_glass_next + 1) % LATENCY_SAMPLES;
     }
 }
 
-} // namespace lens
\ No newline at end of file
+} // namespace lens
@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <oneapi/tbb.h>
 #include <opencv2/opencv.hpp>
 
@@ -13,25 +16,70 @@
 namespace lens
 {
 
+/**
+ * Takes frames from a face pipeline and hands them to the output on a thread of its own. Frames
+ * wait in a bounded mailbox in between, and the output's policy decides what to do when it fills
+ * up, so a slow consumer costs neither unbounded memory nor seconds of latency.
+ *
+ * Several outputs can read the same pipeline. The first one created pipes every frame into all
+ * of their mailboxes, sharing the image rather than copying it, so outputs must not draw on it.
+ * An output that would block drops its oldest frame instead while it has company, so that no
+ * output can hold up the others.
+ */
 class base_output
 {
   public:
     virtual ~base_output() noexcept;
 
+    /** Wait until the pipeline is closed and every image it output has been handled. */
+    void join();
+
+    /** Change how the mailbox makes room, in place of the output's own default. */
+    void set_policy(output_policy policy);
+    output_stats stats() const;
+
+    /** The largest frame the output can use, or an empty size if it keeps frames at any size. */
+    virtual cv::Size target_size() const;
+
   protected:
-    explicit base_output(face_pipeline &pipeline);
+    static constexpr size_t DEFAULT_CAPACITY = 8;
+
+    base_output(face_pipeline &pipeline, output_policy policy, size_t capacity = DEFAULT_CAPACITY);
 
     face_pipeline &pipeline;
-    oneapi::tbb::concurrent_bounded_queue<cv::Mat> buffer_queue;
+
+    /**
+     * Stop handling frames, closing the pipeline if this output pipes it, and wait for the frame
+     * in hand. Derived destructors call this first, so no frame is handled while they run.
+     */
+    void stop() noexcept;
 
   protected:
-    virtual bool handle(cv::Mat &image);
+    /** Output a frame, or return false if the output had to drop it. */
+    virtual bool handle(frame &output);
 
   private:
+    /** The glass-to-glass latencies kept for percentiles, enough for half a minute at 30 FPS. */
+    static constexpr size_t LATENCY_SAMPLES = 1024;
+
+    std::atomic<output_policy> policy;
+    oneapi::tbb::concurrent_bounded_queue<frame> mailbox;
+
+    std::atomic<size_t> received_count;
+    std::atomic<size_t> handled_count;
+    std::atomic<size_t> dropped_count;
+    std::atomic<int64_t> latency_total;
+    std::atomic<int64_t> latency_max;
+    std::vector<int64_t> glass_to_glass;
+    size_t glass_to_glass_next;
+    mutable std::mutex glass_to_glass_mutex;
+
     std::thread pipe_thread;
+    std::thread handle_thread;
 
-    [[noreturn]] void pipe();
-    void push(cv::Mat &image);
+    void pipe();
+    void offer(const frame &output, bool exclusive);
+    void deliver();
 };
 
 } // namespace lens
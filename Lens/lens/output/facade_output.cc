@@ -8,80 +8,148 @@
 namespace lens
 {
 
-facade_output::facade_output(face_pipeline &pipeline, facade_device *device) :
-    base_output(pipeline),
+/** How long to wait for the device to call back before assuming it drained without saying so. */
+constexpr auto WRITABLE_TIMEOUT = std::chrono::milliseconds(100);
+/** More buffers than any device recycles, so a pool that keeps allocating new ones is bounded. */
+constexpr size_t MAX_CLEARED_BUFFERS = 16;
+
+facade_output::facade_output(face_pipeline &pipeline, facade_device *device, int queue_depth) :
+    base_output(pipeline, output_policy::latest_only, 1),
     device(device),
-    flush_pending(true)
+    queue_depth(std::max(1, queue_depth)),
+    in_flight(0)
 {
     facade_error_code open_code = facade_write_open(device);
     if (open_code != facade_error_none)
         throw std::runtime_error("Failed to open Facade device for writing video");
 
     facade_write_callback(
-        device, reinterpret_cast<facade_callback>(facade_output::flush_stub), this);
+        device, reinterpret_cast<facade_callback>(facade_output::on_writable), this);
 }
 
-facade_output::~facade_output() noexcept = default;
-
-bool facade_output::handle(cv::Mat &frame_image)
+facade_output::~facade_output() noexcept
 {
-    flush_mutex.lock();
+    stop();
+    facade_write_callback(device, nullptr, nullptr);
+    facade_write_close(device);
+}
 
-    const bool was_pending = flush_pending;
+cv::Size facade_output::target_size() const
+{
+    return {static_cast<int>(device->width), static_cast<int>(device->height)};
+}
 
-    if (was_pending)
+bool facade_output::handle(frame &output)
+{
     {
-        cv::Mat composited_image;
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // A device that stops calling back must not stall the output forever
+        if (!writable.wait_for(lock, WRITABLE_TIMEOUT, [this] { return in_flight < queue_depth; }))
+            in_flight = 0;
+    }
+
+    facade_error_code code = write_frame(output);
 
-        if (device->width == frame_image.cols && device->height)
+    if (code == facade_error_writer_not_ready)
+    {
+        // Give the device one chance to make room, then drop the frame for a newer one
         {
-            composited_image = frame_image;
+            std::unique_lock<std::mutex> lock(mutex);
+            writable.wait_for(lock, WRITABLE_TIMEOUT);
         }
-        else
-        {
-            composited_image = cv::Mat::zeros(cv::Size(device->width, device->height), CV_8UC4);
-            cv::Rect placement;
 
-            float scale = std::min(1.f,
-                                   std::min(static_cast<float>(composited_image.rows) /
-                                                static_cast<float>(frame_image.rows),
-                                            static_cast<float>(composited_image.cols) /
-                                                static_cast<float>(frame_image.cols)));
+        code = write_frame(output);
+    }
 
-            placement.width = frame_image.cols * scale;
-            placement.height = frame_image.rows * scale;
-            placement.x = (composited_image.cols - placement.width) * 0.5f;
-            placement.y = (composited_image.rows - placement.height) * 0.5f;
+    if (code != facade_error_none)
+        return false;
 
-            std::cout << "TO " << placement << "with scale " << scale << std::endl;
+    std::lock_guard<std::mutex> lock(mutex);
+    in_flight++;
 
-            cv::resize(frame_image, frame_image, placement.size());
-            frame_image.copyTo(composited_image(placement));
-        }
+    return true;
+}
+
+facade_error_code facade_output::write_frame(const frame &output)
+{
+    const cv::Mat &frame_image = output.image;
+    void *buffer = nullptr;
+    size_t stride = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    // Draw straight into the device's own buffer, which it publishes without another copy. The
+    // buffer can still be the old size for a while after the device is resized.
+    const facade_error_code code = facade_write_acquire(device, &buffer, &stride, &width, &height);
+    if (code != facade_error_none)
+        return code;
+
+    const cv::Size target_size(static_cast<int>(width), static_cast<int>(height));
+    cv::Mat composited_image(target_size, CV_8UC4, buffer, stride);
+
+    if (frame_image.size() == target_size)
+    {
+        frame_image.copyTo(composited_image);
+        cleared_buffers.erase(buffer);
+    }
+    else
+    {
+        if (frame_image.size() != frame_size || target_size != device_size)
+            place(frame_image.size(), target_size);
+
+        // The device recycles a few buffers, and each only needs its borders cleared once
+        if (cleared_buffers.size() >= MAX_CLEARED_BUFFERS)
+            cleared_buffers.clear();
+        if (cleared_buffers.insert(buffer).second)
+            composited_image.setTo(cv::Scalar::all(0));
 
-        facade_write_frame(device,
-                           (void *)composited_image.data,
-                           4 * composited_image.cols * composited_image.rows);
-        delete[] const_cast<uint8_t *>(frame_image.data);
+        cv::Mat placed = composited_image(placement);
 
-        flush_pending = false;
+        if (placement.size() == frame_image.size())
+            frame_image.copyTo(placed);
+        else
+            cv::resize(frame_image, placed, placement.size(), 0, 0, cv::INTER_LINEAR);
     }
 
-    flush_mutex.unlock();
+    // The steady clock is the host's monotonic clock, on which libfacade expects timestamps, so
+    // readers see when the frame was captured rather than when it was written
+    const auto captured = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        output.trace.captured.time_since_epoch());
+
+    return facade_write_commit(device, buffer, static_cast<uint64_t>(captured.count()));
+}
 
-    return was_pending;
+void facade_output::place(const cv::Size &source, const cv::Size &target)
+{
+    // Frames are shrunk to fit, but never enlarged
+    const float scale = std::min(1.f,
+                                 std::min(static_cast<float>(target.height) /
+                                              static_cast<float>(source.height),
+                                          static_cast<float>(target.width) /
+                                              static_cast<float>(source.width)));
+
+    placement.width = std::max(1, static_cast<int>(source.width * scale));
+    placement.height = std::max(1, static_cast<int>(source.height * scale));
+    placement.x = (target.width - placement.width) / 2;
+    placement.y = (target.height - placement.height) / 2;
+
+    frame_size = source;
+    device_size = target;
+    cleared_buffers.clear();
+
+    std::cout << "Letterboxing " << source << " frames into " << placement << " of the " << target
+              << " device" << std::endl;
 }
 
-void facade_output::flush_stub(facade_output *output)
+void facade_output::on_writable(facade_output *output)
 {
-    output->flush_mutex.lock();
-    output->flush_pending = true;
-    output->flush_mutex.unlock();
-
-    // Handle the next frame if queued
-    cv::Mat image;
-    if (output->buffer_queue.try_pop(image))
-        output->handle(image);
+    {
+        std::lock_guard<std::mutex> lock(output->mutex);
+        output->in_flight = std::max(0, output->in_flight - 1);
+    }
+
+    output->writable.notify_one();
 }
 
-} // namespace lens
\ No newline at end of file
+} // namespace lens
@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <mutex>
+#include <unordered_set>
 
 #include "base_output.h"
 #include "facade.h"
@@ -13,21 +15,42 @@
 namespace lens
 {
 
+/**
+ * Writes frames to a Facade device, keeping only the newest frame while the device is behind so a
+ * slow consumer never blocks the pipeline. Up to queue_depth frames may be written but not yet
+ * consumed by the device.
+ */
 class facade_output : public base_output
 {
   public:
-    explicit facade_output(face_pipeline &pipeline, facade_device *);
+    facade_output(face_pipeline &pipeline, facade_device *, int queue_depth);
     ~facade_output() noexcept override;
 
+    /** The device's size, since larger frames would only be shrunk to fit it. */
+    cv::Size target_size() const override;
+
   protected:
-    bool handle(cv::Mat &image) override;
+    bool handle(frame &output) override;
 
   private:
     facade_device *device;
-    std::mutex flush_mutex;
-    bool flush_pending;
+    const int queue_depth;
+
+    std::mutex mutex;
+    std::condition_variable writable;
+    int in_flight;
+
+    /** Where frames of frame_size are letterboxed into a device of device_size. */
+    cv::Size frame_size;
+    cv::Size device_size;
+    cv::Rect placement;
+    /** Device buffers whose borders around the placement are already black. */
+    std::unordered_set<void *> cleared_buffers;
+
+    facade_error_code write_frame(const frame &output);
+    void place(const cv::Size &source, const cv::Size &target);
 
-    static void flush_stub(facade_output *);
+    static void on_writable(facade_output *);
 };
 
-} // namespace lens
\ No newline at end of file
+} // namespace lens
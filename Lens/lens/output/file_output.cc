@@ -8,9 +8,15 @@ extern "C" {
 #include <libavutil/timestamp.h>
 #include <libavformat/avformat.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 #include <libswscale/swscale.h>
 }
 
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "../async_io.h"
 #include "file_output.h"
 
 namespace
@@ -30,23 +36,47 @@ void av_print_error(const std::string &message, int av_code)
 namespace lens
 {
 
-file_output::file_output(lens::face_pipeline &pipeline, const std::string &output_path) :
-        base_output(pipeline),
+file_output::file_output(lens::face_pipeline &pipeline,
+                         const std::string &output_path,
+                         const encoder_options &options) :
+        base_output(pipeline, output_policy::block, ENCODE_QUEUE_CAPACITY),
         filepath(output_path),
+        options(options),
+        segmented(output_path.ends_with(".m3u8")),
         context(nullptr),
         codec(avcodec_find_encoder(AV_CODEC_ID_H264)),
         codec_ctx(avcodec_alloc_context3(codec)),
-        frame(av_frame_alloc()),
+        yuv_frame(av_frame_alloc()),
         stream(nullptr),
         sws_ctx(nullptr),
         did_init(false),
-        pts(0)
+        init_failed(false),
+        custom_io(false),
+        frame_count(0),
+        last_pts(AV_NOPTS_VALUE)
 {
-    int context_code = avformat_alloc_output_context2(&context, nullptr, nullptr, output_path.c_str());
+    int context_code;
+
+    if (segmented) {
+        // The segment muxer names each chunk after the playlist and lists them in it
+        const std::string extension = options.segment_format == "mp4" ? ".mp4" : ".ts";
+        const std::string chunk_pattern =
+            output_path.substr(0, output_path.size() - strlen(".m3u8")) + "%05d" + extension;
+
+        if (this->options.fragment_duration <= 0)
+            this->options.fragment_duration = DEFAULT_SEGMENT_DURATION;
+
+        context_code =
+            avformat_alloc_output_context2(&context, nullptr, "segment", chunk_pattern.c_str());
+    } else {
+        context_code =
+            avformat_alloc_output_context2(&context, nullptr, nullptr, output_path.c_str());
+    }
+
     if (!context || context_code < 0)
         throw std::runtime_error("Failed to create output context to write video");
 
-    if (!frame)
+    if (!yuv_frame)
         throw std::runtime_error("Failed to initialize frame");
 
     stream = avformat_new_stream(context, nullptr);
@@ -54,74 +84,241 @@ file_output::file_output(lens::face_pipeline &pipeline, const std::string &outpu
 
 file_output::~file_output() noexcept
 {
-    avcodec_send_frame(codec_ctx, nullptr);
-    flush_packets();
+    stop();
 
-    av_frame_free(&frame);
-    av_write_trailer(context);
-    avio_closep(&context->pb);
+    if (did_init)
+    {
+        avcodec_send_frame(codec_ctx, nullptr);
+        flush_packets();
+        av_write_trailer(context);
+        close_file();
+    }
+
+    sws_freeContext(sws_ctx);
+    av_frame_free(&yuv_frame);
+    avcodec_free_context(&codec_ctx);
     avformat_free_context(context);
 }
 
-bool file_output::handle(cv::Mat &image)
+bool file_output::concat(const std::vector<std::string> &parts, const std::string &output_path)
 {
-    if (!did_init)
+    AVFormatContext *output_ctx = nullptr;
+    AVStream *output_stream = nullptr;
+    int64_t offset = 0;
+    int64_t last_dts = AV_NOPTS_VALUE;
+    bool succeeded = true;
+
+    if (avformat_alloc_output_context2(&output_ctx, nullptr, nullptr, output_path.c_str()) < 0)
     {
-        init(image.cols, image.rows);
+        std::cerr << "Failed to create output context to write " << output_path << std::endl;
+        return false;
+    }
+
+    for (const auto &part : parts)
+    {
+        AVFormatContext *input_ctx = nullptr;
+
+        if (avformat_open_input(&input_ctx, part.c_str(), nullptr, nullptr) < 0 ||
+            avformat_find_stream_info(input_ctx, nullptr) < 0)
+        {
+            std::cerr << "Failed to open the segment " << part << std::endl;
+            avformat_close_input(&input_ctx);
+            succeeded = false;
+            break;
+        }
+
+        const int stream_index =
+            av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (stream_index < 0)
+        {
+            std::cerr << "The segment " << part << " has no video" << std::endl;
+            avformat_close_input(&input_ctx);
+            succeeded = false;
+            break;
+        }
+
+        const AVStream *input_stream = input_ctx->streams[stream_index];
+
+        // The first segment's parameters describe the joined stream; the others were encoded with
+        // the same settings and dimensions, so they share its parameter sets
+        if (!output_stream)
+        {
+            output_stream = avformat_new_stream(output_ctx, nullptr);
+            avcodec_parameters_copy(output_stream->codecpar, input_stream->codecpar);
+            output_stream->codecpar->codec_tag = 0;
+            output_stream->time_base = input_stream->time_base;
+
+            if (avio_open(&output_ctx->pb, output_path.c_str(), AVIO_FLAG_WRITE) < 0 ||
+                avformat_write_header(output_ctx, nullptr) < 0)
+            {
+                std::cerr << "Failed to open " << output_path << std::endl;
+                avformat_close_input(&input_ctx);
+                avformat_free_context(output_ctx);
+                return false;
+            }
+        }
+
+        AVPacket *packet = av_packet_alloc();
+        int64_t part_start = AV_NOPTS_VALUE;
+        int64_t part_end = offset;
+
+        while (av_read_frame(input_ctx, packet) >= 0)
+        {
+            if (packet->stream_index != stream_index)
+            {
+                av_packet_unref(packet);
+                continue;
+            }
+
+            av_packet_rescale_ts(packet, input_stream->time_base, output_stream->time_base);
+
+            // Each segment opens on a keyframe, which is also its first frame to be presented, so
+            // shifting that frame's presentation time onto the previous segment's end leaves no
+            // gap. Decode timestamps lead by the encoder's reorder delay, which every segment
+            // shares.
+            if (part_start == AV_NOPTS_VALUE)
+                part_start = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+            if (packet->pts != AV_NOPTS_VALUE)
+                packet->pts += offset - part_start;
+            if (packet->dts != AV_NOPTS_VALUE)
+                packet->dts += offset - part_start;
+
+            // A segment that reordered differently could step back, which muxers reject
+            if (packet->dts != AV_NOPTS_VALUE)
+            {
+                if (last_dts != AV_NOPTS_VALUE && packet->dts <= last_dts)
+                    packet->dts = last_dts + 1;
+                last_dts = packet->dts;
+            }
+
+            part_end = std::max(part_end,
+                                (packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts) +
+                                    std::max<int64_t>(packet->duration, 1));
+            packet->stream_index = output_stream->index;
+
+            if (av_interleaved_write_frame(output_ctx, packet) < 0)
+            {
+                std::cerr << "Failed to write packet" << std::endl;
+                succeeded = false;
+            }
+
+            av_packet_unref(packet);
+        }
+
+        offset = part_end;
+        av_packet_free(&packet);
+        avformat_close_input(&input_ctx);
+
+        if (!succeeded)
+            break;
     }
 
-    auto *data = reinterpret_cast<uint8_t *>(image.data);
-    int stride[1] = { image.cols * 4 };
-    sws_scale(sws_ctx, &data, stride, 0, codec_ctx->height, frame->data, frame->linesize);
+    if (output_stream)
+    {
+        av_write_trailer(output_ctx);
+        avio_closep(&output_ctx->pb);
+    }
 
-    int p = pts++;
-    frame->pts = p * 512;
+    avformat_free_context(output_ctx);
 
-    AVPacket packet{nullptr};
-    int code;
+    return succeeded && output_stream;
+}
 
-    code = avcodec_send_frame(codec_ctx, frame);
+bool file_output::handle(frame &output) { return encode_frame(output); }
+
+bool file_output::encode_frame(frame &output)
+{
+    cv::Mat &image = output.image;
+
+    // An encoder that failed to open is not retried, so its frames are all counted as dropped
+    if (init_failed)
+        return false;
+    if (!did_init && !init(image.cols, image.rows, output.frame_rate)) {
+        init_failed = true;
+        return false;
+    }
+
+    // The encoder may still hold a reference to the last frame's planes
+    if (av_frame_make_writable(yuv_frame) < 0) {
+        std::cerr << "Failed to make the encoder frame writable" << std::endl;
+        return false;
+    }
+
+    const uint8_t *data[1] = { image.data };
+    int stride[1] = { static_cast<int>(image.step) };
+    sws_scale(sws_ctx, data, stride, 0, codec_ctx->height, yuv_frame->data, yuv_frame->linesize);
+
+    // Frames without source timestamps are spaced at the nominal frame rate; the encoder rejects
+    // timestamps that do not increase
+    int64_t pts = output.pts ? output.pts->count()
+                             : static_cast<int64_t>(frame_count) * 1000000 / options.frame_rate;
+    if (last_pts != AV_NOPTS_VALUE && pts <= last_pts)
+        pts = last_pts + 1;
+
+    yuv_frame->pts = pts;
+    last_pts = pts;
+    ++frame_count;
+
+    int code = avcodec_send_frame(codec_ctx, yuv_frame);
     if (code < 0) {
         av_print_error("Failed to send frame for encoding", code);
-        return true;
+        return false;
     }
 
     flush_packets();
-
-    delete[] data;
-
     return true;
 }
 
-bool file_output::init(size_t width, size_t height)
+bool file_output::init(size_t width, size_t height, const std::optional<rational> &source_rate)
 {
     codec_ctx->codec_id = AV_CODEC_ID_H264;
     codec_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
     codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
     codec_ctx->width = width;
     codec_ctx->height = height;
-    codec_ctx->framerate = {30,1};
-    codec_ctx->time_base = {1,15360};
+    // Sources without a rate of their own are assumed to run at the nominal one
+    const rational frame_rate = source_rate.value_or(rational{options.frame_rate, 1});
+    codec_ctx->framerate = { frame_rate.num, frame_rate.den };
+    codec_ctx->time_base = { 1, 1000000 };
+    codec_ctx->thread_count = options.threads;
+    codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    // Fragments and chunks can only start on a keyframe, so one is placed at every boundary
+    if (options.gop_size > 0)
+        codec_ctx->gop_size = options.gop_size;
+    else if (options.fragment_duration > 0)
+        codec_ctx->gop_size = std::max(
+            1, static_cast<int>(options.fragment_duration * frame_rate.num / frame_rate.den));
+
+    if (options.bit_rate > 0)
+        codec_ctx->bit_rate = options.bit_rate;
+    else
+        av_opt_set_int(codec_ctx->priv_data, "crf", options.crf, 0);
+
+    if (!options.preset.empty())
+        av_opt_set(codec_ctx->priv_data, "preset", options.preset.c_str(), 0);
+    if (!options.tune.empty())
+        av_opt_set(codec_ctx->priv_data, "tune", options.tune.c_str(), 0);
+
+    if (context->oformat->flags & AVFMT_GLOBALHEADER)
+        codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
     if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
         std::cerr << "Failed to open video codec" << std::endl;
+        return false;
+    }
+
+    yuv_frame->width = width;
+    yuv_frame->height = height;
+    yuv_frame->format = AV_PIX_FMT_YUV420P;
+    if (av_frame_get_buffer(yuv_frame, 0) < 0) {
+        std::cerr << "Failed to allocate the encoder frame" << std::endl;
+        return false;
     }
 
-    frame->width = width;
-    frame->height = height;
-    frame->format = AV_PIX_FMT_YUV420P;
-    frame->key_frame = 1;
-    frame->pict_type = AV_PICTURE_TYPE_I;
-    frame->duration = 1;
-    int bufferSize = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
-    uint8_t* buffer = (uint8_t*)av_malloc(bufferSize);
-    av_image_fill_arrays(frame->data, frame->linesize, buffer, AV_PIX_FMT_YUV420P, width, height, 1);
-
-    stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-    stream->codecpar->codec_id = AV_CODEC_ID_H264;
-    stream->codecpar->codec_tag = 0;
-    stream->codecpar->width = width;
-    stream->codecpar->height = height;
-    stream->time_base = { 1, 12800 };
+    avcodec_parameters_from_context(stream->codecpar, codec_ctx);
+    stream->time_base = codec_ctx->time_base;
 
     sws_ctx = sws_getContext(codec_ctx->width,
                              codec_ctx->height,
@@ -134,22 +331,72 @@ bool file_output::init(size_t width, size_t height)
                              nullptr,
                              nullptr);
 
-    int ret = avio_open(&context->pb, filepath.c_str(), AVIO_FLAG_WRITE);
-    if (ret < 0) {
-        throw std::runtime_error("Failed to open output file");
+    if (!(context->oformat->flags & AVFMT_NOFILE)) {
+#ifdef LENS_FEATURE_ASYNC_IO
+        context->pb = open_async_io(filepath, true);
+        custom_io = context->pb != nullptr;
+#endif
+        if (!context->pb && avio_open(&context->pb, filepath.c_str(), AVIO_FLAG_WRITE) < 0) {
+            std::cerr << "Failed to open output file " << filepath << std::endl;
+            return false;
+        }
     }
 
-    int open_code = avformat_write_header(context, nullptr);
-    if (open_code < -1) {
-        constexpr int error_length = 100;
-        char error_description[error_length] = { 0 };
-        bool error_found = av_strerror(open_code, error_description, error_length) == 0;
+    AVDictionary *header_options = muxer_options();
+    int open_code = avformat_write_header(context, &header_options);
+    av_dict_free(&header_options);
 
-        std::cout << "ERROR" <<  (error_found ? error_description :  "Failed to write header (unknown error)" )<< std::endl;
-        throw std::runtime_error(error_found ? error_description :  "Failed to write header (unknown error)");
+    if (open_code < 0) {
+        av_print_error("Failed to write header", open_code);
+        close_file();
+        return false;
     }
 
     did_init = true;
+
+    return true;
+}
+
+void file_output::close_file()
+{
+    if (context->oformat->flags & AVFMT_NOFILE)
+        return;
+
+#ifdef LENS_FEATURE_ASYNC_IO
+    if (custom_io) {
+        if (!close_async_io(&context->pb))
+            std::cerr << "Failed to write the output file " << filepath << std::endl;
+        return;
+    }
+#endif
+    avio_closep(&context->pb);
+}
+
+AVDictionary *file_output::muxer_options() const
+{
+    AVDictionary *muxer_options = nullptr;
+
+    if (segmented) {
+        av_dict_set(&muxer_options, "segment_list", filepath.c_str(), 0);
+        av_dict_set(&muxer_options, "segment_list_type", "m3u8", 0);
+        av_dict_set(&muxer_options, "segment_format", options.segment_format.c_str(), 0);
+        av_dict_set(
+            &muxer_options, "segment_time", std::to_string(options.fragment_duration).c_str(), 0);
+
+        // The playlist is rewritten after every chunk so it can be followed while the job runs
+        av_dict_set(&muxer_options, "segment_list_flags", "+live", 0);
+    } else if (options.fragment_duration > 0 &&
+               (filepath.ends_with(".mp4") || filepath.ends_with(".mov"))) {
+        // An empty moov up front and self-contained fragments let readers start before the end,
+        // and the muxer no longer holds an index of the whole file in memory
+        av_dict_set(&muxer_options, "movflags", "+frag_keyframe+empty_moov+default_base_moof", 0);
+        av_dict_set_int(&muxer_options,
+                        "frag_duration",
+                        static_cast<int64_t>(options.fragment_duration * 1000000),
+                        0);
+    }
+
+    return muxer_options;
 }
 
 void file_output::flush_packets()
@@ -157,7 +404,11 @@ void file_output::flush_packets()
     AVPacket packet{nullptr};
 
     while (avcodec_receive_packet(codec_ctx, &packet) >= 0) {
-        if (av_write_frame(context, &packet) < 0) {
+        // The muxer can change the stream's time base when it writes the header
+        av_packet_rescale_ts(&packet, codec_ctx->time_base, stream->time_base);
+        packet.stream_index = stream->index;
+
+        if (av_interleaved_write_frame(context, &packet) < 0) {
             std::cerr << "Failed to write packet" << std::endl;
             av_packet_unref(&packet);
             break;
@@ -167,4 +418,4 @@ void file_output::flush_packets()
     }
 }
 
-} // namespace lens
\ No newline at end of file
+} // namespace lens
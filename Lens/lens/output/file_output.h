@@ -9,7 +9,8 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
-#include <atomic>
+#include <string>
+#include <vector>
 
 #include "base_output.h"
 #include "lens.h"
@@ -17,27 +18,55 @@ extern "C" {
 namespace lens
 {
 
+/**
+ * Encodes the pipeline's output into an H.264 video file on the output's handler thread. Its
+ * mailbox blocks rather than drops, so the pipeline is held up when the encoder falls behind.
+ *
+ * A .m3u8 path writes a playlist of fixed-duration chunks next to it, and a fragment duration
+ * writes MP4 and MOV files as fragments instead of indexing them in the trailer.
+ */
 class file_output : public base_output
 {
 public:
-    explicit file_output(face_pipeline &pipeline, const std::string &output_path);
+    explicit file_output(face_pipeline &pipeline,
+                         const std::string &output_path,
+                         const encoder_options &options = {});
     ~file_output() noexcept override;
 
+    /**
+     * Join video files written by file_output into one, copying their packets without re-encoding
+     * and offsetting each file's timestamps to follow the one before it.
+     */
+    static bool concat(const std::vector<std::string> &parts, const std::string &output_path);
+
 protected:
-    bool handle(cv::Mat &image) override;
+    bool handle(frame &output) override;
 private:
+    static constexpr int ENCODE_QUEUE_CAPACITY = 8;
+    static constexpr double DEFAULT_SEGMENT_DURATION = 2;
+
     std::string filepath;
+    encoder_options options;
+    bool segmented;
     AVFormatContext *context;
     const AVCodec *codec;
     AVCodecContext *codec_ctx;
-    AVFrame *frame;
+    AVFrame *yuv_frame;
     AVStream *stream;
     struct SwsContext *sws_ctx;
     bool did_init;
-    int pts;
+    /** Whether init() failed, after which every frame is dropped. */
+    bool init_failed;
+    /** Whether context->pb came from open_async_io rather than avio_open. */
+    bool custom_io;
+    size_t frame_count;
+    int64_t last_pts;
 
-    bool init(size_t width, size_t height);
+    bool init(size_t width, size_t height, const std::optional<rational> &source_rate);
+    void close_file();
+    AVDictionary *muxer_options() const;
+    bool encode_frame(frame &output);
     void flush_packets();
 };
 
-} // namespace lens
\ No newline at end of file
+} // namespace lens
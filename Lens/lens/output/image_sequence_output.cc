@@ -0,0 +1,82 @@
+#include <iostream>
+
+#include "image_sequence_output.h"
+
+namespace fs = std::filesystem;
+
+namespace lens
+{
+
+image_sequence_output::image_sequence_output(face_pipeline &pipeline, const fs::path &directory) :
+    base_output(pipeline, output_policy::block),
+    directory(directory),
+    claimed_paths(),
+    pending_writes(0),
+    written_count(0)
+{
+    fs::create_directories(directory);
+}
+
+image_sequence_output::~image_sequence_output() noexcept
+{
+    stop();
+    writers.wait();
+}
+
+fs::path image_sequence_output::output_path(const fs::path &directory, const std::string &source)
+{
+    return directory / fs::path(source).filename();
+}
+
+void image_sequence_output::wait() { writers.wait(); }
+
+size_t image_sequence_output::written() const { return written_count; }
+
+bool image_sequence_output::handle(frame &output)
+{
+    if (output.source.empty())
+    {
+        std::cerr << "Dropping an image with no source file to name it after" << std::endl;
+        return false;
+    }
+
+    const fs::path path = output_path(directory, output.source);
+
+    if (!claimed_paths.insert(path).second)
+    {
+        std::cerr << "Dropping " << output.source << ", which would overwrite " << path
+                  << std::endl;
+        return false;
+    }
+
+    // Encoding is slower than face swap for large PNGs, but the backlog of images held for it is
+    // bounded by writing inline once it grows too long
+    if (pending_writes >= MAX_PENDING_WRITES)
+    {
+        write(output.image, path);
+        return true;
+    }
+
+    ++pending_writes;
+    writers.run(
+        [this, image = output.image, path]()
+        {
+            write(image, path);
+            --pending_writes;
+        });
+
+    return true;
+}
+
+void image_sequence_output::write(const cv::Mat &image, const fs::path &path)
+{
+    cv::Mat bgr_image;
+    cv::cvtColor(image, bgr_image, cv::COLOR_BGRA2BGR);
+
+    if (cv::imwrite(path.string(), bgr_image))
+        ++written_count;
+    else
+        std::cerr << "Failed to write " << path << std::endl;
+}
+
+} // namespace lens
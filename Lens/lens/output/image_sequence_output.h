@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <oneapi/tbb.h>
+#include <set>
+
+#include "base_output.h"
+#include "lens.h"
+
+namespace lens
+{
+
+/**
+ * Writes each output image into a directory, named after the file it was loaded from, and drops
+ * images named like one it already wrote. Images are encoded on the TBB task arena so the pipe
+ * thread is free to take the next one.
+ */
+class image_sequence_output : public base_output
+{
+  public:
+    image_sequence_output(face_pipeline &pipeline, const std::filesystem::path &directory);
+    ~image_sequence_output() noexcept override;
+
+    /** Where the image loaded from source is written. */
+    static std::filesystem::path output_path(const std::filesystem::path &directory,
+                                             const std::string &source);
+
+    /** Wait for the images already handled to finish writing. */
+    void wait();
+    /** The number of images written so far. */
+    size_t written() const;
+
+  protected:
+    bool handle(frame &output) override;
+
+  private:
+    static constexpr int MAX_PENDING_WRITES = 32;
+
+    std::filesystem::path directory;
+    /** The paths images were written to, so an image with the same name does not replace one. */
+    std::set<std::filesystem::path> claimed_paths;
+    oneapi::tbb::task_group writers;
+    std::atomic<int> pending_writes;
+    std::atomic<size_t> written_count;
+
+    void write(const cv::Mat &image, const std::filesystem::path &path);
+};
+
+} // namespace lens
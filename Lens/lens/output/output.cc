@@ -7,15 +7,21 @@
 #include <string>
 
 #include "base_output.h"
+#include "image_sequence_output.h"
+#include "stream_output.h"
+#ifdef LENS_FEATURE_FACADE
 #include "facade_output.h"
+#endif
+#ifdef LENS_FEATURE_FILE_IO
 #include "file_output.h"
+#endif
 
 namespace fs = std::filesystem;
 
 namespace
 {
 
-std::vector<std::string> video_formats = {"mp4", "mov", "avi", "mkv", "wmv"};
+std::vector<std::string> video_formats = {"mp4", "mov", "avi", "mkv", "wmv", "m3u8"};
 
 bool match(const std::vector<std::string> &formats, const std::string &path)
 {
@@ -31,8 +37,19 @@ bool match(const std::vector<std::string> &formats, const std::string &path)
 namespace lens
 {
 
-std::unique_ptr<base_output> output(face_pipeline &pipeline, std::string &dst, bool loop)
+std::unique_ptr<base_output> output(face_pipeline &pipeline,
+                                    std::string &dst,
+                                    bool loop,
+                                    const encoder_options &encoder)
 {
+    if (!loop && dst == "-")
+        return std::unique_ptr<base_output>(
+            new stream_output(pipeline, encoder.stream, encoder.frame_rate));
+
+    if (!loop && (fs::is_directory(dst) || dst.ends_with('/')))
+        return std::unique_ptr<base_output>(new image_sequence_output(pipeline, dst));
+
+#ifdef LENS_FEATURE_FACADE
     facade_device *device = nullptr;
 
     facade_init();
@@ -44,12 +61,19 @@ std::unique_ptr<base_output> output(face_pipeline &pipeline, std::string &dst, b
         throw std::runtime_error("The Facade device " + dst + " does not exist.");
 
     if (device)
-        return std::unique_ptr<base_output>(new facade_output(pipeline, device));
-
+        return std::unique_ptr<base_output>(
+            new facade_output(pipeline, device, encoder.device_queue_depth));
+#else
+    if (loop || dst.find('.') == std::string::npos)
+        throw std::runtime_error("Facade devices are not supported in this build of lens.");
+#endif
+
+#ifdef LENS_FEATURE_FILE_IO
     fs::path dst_path{dst};
 
     if (match(video_formats, dst_path))
-        return std::unique_ptr<base_output>(new file_output(pipeline, dst));
+        return std::unique_ptr<base_output>(new file_output(pipeline, dst, encoder));
+#endif
 
     return nullptr;
 }
@@ -0,0 +1,126 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "stream_output.h"
+
+namespace
+{
+
+constexpr int PIPE_BUFFER_SIZE = 1 << 20;
+
+bool write_fully(int fd, const void *buffer, size_t size)
+{
+    const auto *cursor = static_cast<const uint8_t *>(buffer);
+
+    while (size > 0)
+    {
+        ssize_t count = write(fd, cursor, size);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return false;
+
+        cursor += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+} // namespace
+
+namespace lens
+{
+
+stream_output::stream_output(face_pipeline &pipeline, stream_format format, int frame_rate) :
+    base_output(pipeline, output_policy::block),
+    format(format),
+    frame_rate(frame_rate),
+    size(),
+    closed(false)
+{
+#ifdef F_SETPIPE_SZ
+    fcntl(STDOUT_FILENO, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+}
+
+stream_output::~stream_output() noexcept { stop(); }
+
+bool stream_output::handle(frame &output)
+{
+    if (closed)
+        return false;
+
+    cv::Mat image = output.image;
+
+    // Y4M frames are 4:2:0, which needs even dimensions
+    if (format == stream_format::y4m)
+        image = image(cv::Rect(0, 0, image.cols & ~1, image.rows & ~1));
+
+    if (size.empty() && !write_header(image.size(), output.frame_rate))
+        return false;
+
+    if (image.size() != size)
+    {
+        std::cerr << "Dropping a " << image.size() << " frame from a " << size << " stream"
+                  << std::endl;
+        return false;
+    }
+
+    if (format == stream_format::bgra)
+    {
+        if (!image.isContinuous())
+            image = image.clone();
+
+        if (!write_fully(STDOUT_FILENO, image.data, image.total() * image.elemSize()))
+            return close_stream();
+
+        return true;
+    }
+
+    static const std::string frame_marker = "FRAME\n";
+    cv::cvtColor(image, yuv_image, cv::COLOR_BGRA2YUV_I420);
+
+    if (!write_fully(STDOUT_FILENO, frame_marker.data(), frame_marker.size()) ||
+        !write_fully(STDOUT_FILENO, yuv_image.data, yuv_image.total()))
+        return close_stream();
+
+    return true;
+}
+
+bool stream_output::write_header(const cv::Size &frame_size,
+                                 const std::optional<rational> &source_rate)
+{
+    size = frame_size;
+
+    if (format != stream_format::y4m)
+        return true;
+
+    // Sources without a rate of their own are paced at the nominal one
+    const rational rate = source_rate.value_or(rational{frame_rate, 1});
+    const std::string header = "YUV4MPEG2 W" + std::to_string(size.width) + " H" +
+                               std::to_string(size.height) + " F" + std::to_string(rate.num) +
+                               ":" + std::to_string(rate.den) + " Ip A1:1 C420jpeg\n";
+
+    return write_fully(STDOUT_FILENO, header.data(), header.size()) || close_stream();
+}
+
+bool stream_output::close_stream()
+{
+    // A frame cut off partway leaves the reader out of step, so nothing more is written
+    if (errno == EPIPE)
+        std::cerr << "The reader of stdout has gone away; dropping the rest of the stream"
+                  << std::endl;
+    else
+        std::cerr << "Failed to write to stdout: " << std::strerror(errno) << std::endl;
+
+    closed = true;
+    return false;
+}
+
+} // namespace lens
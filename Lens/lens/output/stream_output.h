@@ -0,0 +1,36 @@
+#pragma once
+
+#include "base_output.h"
+#include "lens.h"
+
+namespace lens
+{
+
+/**
+ * Writes uncompressed frames to stdout, as a Y4M stream or as bare BGRA frames, so lens can feed
+ * another process in a shell pipeline.
+ */
+class stream_output : public base_output
+{
+  public:
+    stream_output(face_pipeline &pipeline, stream_format format, int frame_rate);
+    ~stream_output() noexcept override;
+
+  protected:
+    bool handle(frame &output) override;
+
+  private:
+    stream_format format;
+    /** The rate written in the Y4M header when the source does not have one. */
+    int frame_rate;
+    cv::Size size;
+    cv::Mat yuv_image;
+    /** Whether a write failed, after which every frame is dropped. */
+    bool closed;
+
+    bool write_header(const cv::Size &frame_size, const std::optional<rational> &source_rate);
+    /** Stop writing after a failed write, and return false so the frame counts as dropped. */
+    bool close_stream();
+};
+
+} // namespace lens
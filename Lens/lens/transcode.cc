@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "input/video.h"
+#include "lens.h"
+#include "output/file_output.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+/** Frames decoded before each segment to seed face tracking from where the last one left off. */
+constexpr int OVERLAP_FRAMES = 4;
+
+struct segment
+{
+    int64_t warm_up_start;
+    int64_t start;
+    int64_t end;
+    std::string path;
+};
+
+std::vector<segment> split(const std::string &src, const std::string &dst, int count)
+{
+    lens::video_input probe(src, 0);
+    const std::vector<int64_t> keyframes = probe.keyframes();
+    const int64_t overlap = OVERLAP_FRAMES * probe.frame_duration();
+
+    // Boundaries are spread evenly over the keyframes, which tracks time for a fixed GOP length
+    std::vector<int64_t> boundaries;
+    for (int i = 1; i < count && !keyframes.empty(); i++)
+    {
+        const int64_t boundary = keyframes[i * keyframes.size() / count];
+        if (boundary != keyframes.front() && (boundaries.empty() || boundary > boundaries.back()))
+            boundaries.push_back(boundary);
+    }
+
+    const fs::path dst_path{dst};
+    std::vector<segment> segments;
+
+    for (size_t i = 0; i <= boundaries.size(); i++)
+    {
+        fs::path part_path = dst_path;
+        part_path.replace_filename(dst_path.stem().string() + ".part" + std::to_string(i) +
+                                   dst_path.extension().string());
+
+        segments.push_back({
+            .warm_up_start =
+                i == 0 ? std::numeric_limits<int64_t>::min() : boundaries[i - 1] - overlap,
+            .start = i == 0 ? std::numeric_limits<int64_t>::min() : boundaries[i - 1],
+            .end = i == boundaries.size() ? std::numeric_limits<int64_t>::max() : boundaries[i],
+            .path = part_path.string(),
+        });
+    }
+
+    return segments;
+}
+
+void run_segment(const std::string &src,
+                 const segment &part,
+                 const lens::face_pipeline_models &models,
+                 const lens::encoder_options &encoder,
+                 bool &succeeded)
+{
+    try
+    {
+        lens::face_pipeline pipeline(models, 1);
+        lens::file_output output(pipeline, part.path, encoder);
+        lens::video_input input(src, 0);
+
+        input.set_range(part.warm_up_start, part.start, part.end);
+        input.run(pipeline);
+        pipeline.close();
+        output.join();
+        succeeded = true;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Failed to process the segment " << part.path << ": " << e.what()
+                  << std::endl;
+        succeeded = false;
+    }
+}
+
+} // namespace
+
+namespace lens
+{
+
+bool transcode(const std::string &src,
+               const std::string &dst,
+               int segments,
+               const face_pipeline_models &models,
+               const encoder_options &encoder)
+{
+    const std::vector<segment> parts = split(src, dst, segments);
+    std::vector<std::thread> workers;
+    std::unique_ptr<bool[]> succeeded(new bool[parts.size()]());
+
+    std::cout << "Processing " << src << " in " << parts.size() << " segments" << std::endl;
+
+    for (size_t i = 0; i < parts.size(); i++)
+        workers.emplace_back(run_segment,
+                             std::cref(src),
+                             std::cref(parts[i]),
+                             std::cref(models),
+                             std::cref(encoder),
+                             std::ref(succeeded[i]));
+
+    for (auto &worker : workers)
+        worker.join();
+
+    std::vector<std::string> part_paths;
+    bool all_succeeded = true;
+
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        part_paths.push_back(parts[i].path);
+        all_succeeded = all_succeeded && succeeded[i];
+    }
+
+    const bool joined = all_succeeded && file_output::concat(part_paths, dst);
+
+    for (const auto &path : part_paths)
+        fs::remove(path);
+
+    return joined;
+}
+
+} // namespace lens
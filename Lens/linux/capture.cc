@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/videodev2.h>
+#include <memory>
+#include <optional>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "internal.h"
+#include "lens.h"
+
+namespace
+{
+
+constexpr int BUFFER_COUNT = 6;
+constexpr int CAPTURE_WIDTH = 1280;
+constexpr int CAPTURE_HEIGHT = 720;
+constexpr int POLL_TIMEOUT_MS = 2000;
+
+/** Formats laid out in memory as B, G, R, A bytes, which the pipeline can use in place. */
+constexpr uint32_t BGRA_FORMATS[] = {V4L2_PIX_FMT_ABGR32, V4L2_PIX_FMT_XBGR32, V4L2_PIX_FMT_BGR32};
+/** Formats that are converted to BGRA as they are dequeued. */
+constexpr uint32_t YUV_FORMATS[] = {V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_NV12};
+
+int xioctl(int fd, unsigned long request, void *arg)
+{
+    int code;
+    do
+        code = ioctl(fd, request, arg);
+    while (code < 0 && errno == EINTR);
+
+    return code;
+}
+
+std::string fourcc(uint32_t format)
+{
+    return {static_cast<char>(format & 0xff),
+            static_cast<char>((format >> 8) & 0xff),
+            static_cast<char>((format >> 16) & 0xff),
+            static_cast<char>((format >> 24) & 0xff)};
+}
+
+/**
+ * A V4L2 device streaming into mmap'd buffers. BGRA buffers reach the pipeline as views that hold
+ * a reference to the device and queue the buffer back to the driver once the last view is gone,
+ * so the device is only stopped and unmapped after the pipeline has let go of every frame.
+ */
+class capture_device : public std::enable_shared_from_this<capture_device>
+{
+  public:
+    capture_device(const std::string &path, int frame_rate);
+    ~capture_device() noexcept;
+
+    void start();
+    /**
+     * Wait for the next frame. Returns false if the device failed; the frame's image is left
+     * empty if no frame arrived in time or the driver flagged it as corrupt.
+     */
+    bool next(lens::frame &input);
+
+    int width;
+    int height;
+    uint32_t pixel_format;
+    /** The frame rate the driver settled on, if it lets the rate be set. */
+    std::optional<lens::rational> rate;
+
+  private:
+    struct mapping
+    {
+        void *start;
+        size_t length;
+    };
+
+    int fd;
+    size_t bytes_per_line;
+    std::vector<mapping> buffers;
+    bool streaming;
+    /** The driver's timestamp for the first frame, which frames' timestamps are measured from. */
+    std::optional<std::chrono::microseconds> start_timestamp;
+
+    uint32_t choose_format() const;
+    bool requeue(uint32_t index);
+};
+
+capture_device::capture_device(const std::string &path, int frame_rate) :
+    width(0),
+    height(0),
+    pixel_format(0),
+    rate(),
+    fd(open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC)),
+    bytes_per_line(0),
+    buffers(),
+    streaming(false),
+    start_timestamp()
+{
+    if (fd < 0)
+        throw std::runtime_error(std::string("Failed to open the device: ") + strerror(errno));
+
+    v4l2_capability capability{};
+    if (xioctl(fd, VIDIOC_QUERYCAP, &capability) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Not a V4L2 device");
+    }
+
+    const uint32_t caps = capability.capabilities & V4L2_CAP_DEVICE_CAPS
+                              ? capability.device_caps
+                              : capability.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+    {
+        close(fd);
+        throw std::runtime_error("The device does not support streaming video capture");
+    }
+
+    v4l2_format format{};
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = CAPTURE_WIDTH;
+    format.fmt.pix.height = CAPTURE_HEIGHT;
+    format.fmt.pix.pixelformat = choose_format();
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+
+    if (!format.fmt.pix.pixelformat || xioctl(fd, VIDIOC_S_FMT, &format) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("The device does not capture BGRA, YUYV or NV12");
+    }
+
+    // The driver picks the nearest size it supports and pads lines as it likes
+    width = static_cast<int>(format.fmt.pix.width);
+    height = static_cast<int>(format.fmt.pix.height);
+    pixel_format = format.fmt.pix.pixelformat;
+    bytes_per_line = format.fmt.pix.bytesperline;
+
+    v4l2_streamparm parameters{};
+    parameters.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_G_PARM, &parameters) == 0 &&
+        parameters.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)
+    {
+        parameters.parm.capture.timeperframe = {1, static_cast<uint32_t>(frame_rate)};
+
+        // The driver picks the nearest interval it supports and reports it back
+        const v4l2_fract &interval = parameters.parm.capture.timeperframe;
+        if (xioctl(fd, VIDIOC_S_PARM, &parameters) == 0 && interval.numerator > 0 &&
+            interval.denominator > 0)
+            rate = lens::rational{static_cast<int>(interval.denominator),
+                                  static_cast<int>(interval.numerator)};
+    }
+
+    v4l2_requestbuffers request{};
+    request.count = BUFFER_COUNT;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+
+    if (xioctl(fd, VIDIOC_REQBUFS, &request) < 0 || request.count < 2)
+    {
+        close(fd);
+        throw std::runtime_error("The device does not support mmap streaming");
+    }
+
+    for (uint32_t i = 0; i < request.count; i++)
+    {
+        v4l2_buffer buffer{};
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.index = i;
+
+        void *start = MAP_FAILED;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buffer) == 0)
+            start = mmap(nullptr,
+                         buffer.length,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED,
+                         fd,
+                         buffer.m.offset);
+
+        if (start == MAP_FAILED)
+        {
+            for (auto &mapped : buffers)
+                munmap(mapped.start, mapped.length);
+            close(fd);
+            throw std::runtime_error("Failed to map the capture buffers");
+        }
+
+        buffers.push_back({start, buffer.length});
+    }
+}
+
+capture_device::~capture_device() noexcept
+{
+    if (streaming)
+    {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(fd, VIDIOC_STREAMOFF, &type);
+    }
+
+    for (auto &mapped : buffers)
+        munmap(mapped.start, mapped.length);
+    close(fd);
+}
+
+uint32_t capture_device::choose_format() const
+{
+    std::vector<uint32_t> supported;
+    v4l2_fmtdesc description{};
+    description.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    while (xioctl(fd, VIDIOC_ENUM_FMT, &description) == 0)
+    {
+        supported.push_back(description.pixelformat);
+        description.index++;
+    }
+
+    auto is_supported = [&supported](uint32_t format) {
+        return std::find(supported.begin(), supported.end(), format) != supported.end();
+    };
+
+    for (uint32_t format : BGRA_FORMATS)
+        if (is_supported(format))
+            return format;
+    for (uint32_t format : YUV_FORMATS)
+        if (is_supported(format))
+            return format;
+
+    return 0;
+}
+
+void capture_device::start()
+{
+    for (uint32_t i = 0; i < buffers.size(); i++)
+        if (!requeue(i))
+            throw std::runtime_error("Failed to queue the capture buffers");
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0)
+        throw std::runtime_error(std::string("Failed to start streaming: ") + strerror(errno));
+
+    streaming = true;
+}
+
+bool capture_device::next(lens::frame &input)
+{
+    pollfd readable{.fd = fd, .events = POLLIN};
+    const int polled = poll(&readable, 1, POLL_TIMEOUT_MS);
+
+    if (polled < 0 && errno != EINTR)
+        return false;
+    if (polled <= 0)
+        return true;
+
+    v4l2_buffer buffer{};
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+
+    if (xioctl(fd, VIDIOC_DQBUF, &buffer) < 0)
+        return errno == EAGAIN;
+
+    if (buffer.flags & V4L2_BUF_FLAG_ERROR)
+    {
+        requeue(buffer.index);
+        return true;
+    }
+
+    auto *data = static_cast<uint8_t *>(buffers[buffer.index].start);
+    const std::chrono::microseconds timestamp = std::chrono::seconds(buffer.timestamp.tv_sec) +
+                                                std::chrono::microseconds(buffer.timestamp.tv_usec);
+
+    // Monotonic timestamps are on the steady clock, and mark when the driver captured the frame
+    if ((buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        input.trace.captured = std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(timestamp));
+
+    // Encoders count from the first frame rather than from when the host booted
+    if (!start_timestamp)
+        start_timestamp = timestamp;
+    input.pts = timestamp - *start_timestamp;
+    input.frame_rate = rate;
+
+    switch (pixel_format)
+    {
+    case V4L2_PIX_FMT_YUYV:
+        cv::cvtColor(cv::Mat(height, width, CV_8UC2, data, bytes_per_line),
+                     input.image,
+                     cv::COLOR_YUV2BGRA_YUY2);
+        requeue(buffer.index);
+        break;
+    case V4L2_PIX_FMT_NV12:
+        cv::cvtColor(cv::Mat(height * 3 / 2, width, CV_8UC1, data, bytes_per_line),
+                     input.image,
+                     cv::COLOR_YUV2BGRA_NV12);
+        requeue(buffer.index);
+        break;
+    default:
+    {
+        // Hand the pipeline the driver's buffer itself, and queue it back once the pipeline is done
+        auto self = shared_from_this();
+        const uint32_t index = buffer.index;
+        input.image = lens::wrap_buffer(
+            height, width, CV_8UC4, data, bytes_per_line, [self, index] { self->requeue(index); });
+        break;
+    }
+    }
+
+    return true;
+}
+
+bool capture_device::requeue(uint32_t index)
+{
+    v4l2_buffer buffer{};
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = index;
+
+    if (xioctl(fd, VIDIOC_QBUF, &buffer) < 0)
+    {
+        std::cerr << "Failed to queue capture buffer " << index << ": " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
+bool load_camera(const std::string &path, int frame_rate, lens::face_pipeline &pipeline)
+{
+    std::shared_ptr<capture_device> device;
+
+    try
+    {
+        device = std::make_shared<capture_device>(path, frame_rate);
+        device->start();
+    }
+    catch (std::runtime_error &e)
+    {
+        std::cout << "There was a problem capturing " << path << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    std::cout << "Capturing " << device->width << "x" << device->height << " "
+              << fourcc(device->pixel_format) << " from " << path << std::endl;
+
+    while (true)
+    {
+        lens::frame input;
+        if (!device->next(input))
+            break;
+        if (!input.image.empty())
+            pipeline << input;
+    }
+
+    std::cout << "The video capture thread has unexpectedly ended" << std::endl;
+    return false;
+}
@@ -2,15 +2,12 @@
 // Created by Shukant Pal on 5/26/23.
 //
 
-#include <onnxruntime/core/providers/coreml/coreml_provider_factory.h>
-#include <onnxruntime/core/session/onnxruntime_c_api.h>
-#include <onnxruntime/core/session/onnxruntime_cxx_api.h>
-
 #include "internal.h"
+#include "onnx.h"
 
 namespace fs = std::filesystem;
 
-namespace lens
+namespace lens::onnx
 {
 
 static const size_t EXPECTED_ROWS = 480;
@@ -105,19 +102,13 @@ void center_face_impl::run(const cv::Mat &image,
     }
 }
 
-std::unique_ptr<center_face> center_face::build(const fs::path &model_dir)
+std::unique_ptr<center_face> build_center_face(const fs::path &model_dir)
 {
-    Ort::Env env(ORT_LOGGING_LEVEL_INFO, "CenterFace");
-    Ort::SessionOptions session_options;
-
-#ifdef APPLE
-    OrtSessionOptionsAppendExecutionProvider_CoreML(session_options, COREML_FLAG_USE_NONE);
-#endif
-
-    std::string model_path = (path / "CenterFace.onnx").string();
+    Ort::SessionOptions session_options = onnx::session_options();
+    std::string model_path = (model_dir / "CenterFace.onnx").string();
 
     return std::unique_ptr<center_face>(
-        new center_face_impl(new Ort::Session(env, model_path.c_str(), session_options)));
+        new center_face_impl(new Ort::Session(onnx::env(), model_path.c_str(), session_options)));
 }
 
-} // namespace lens
\ No newline at end of file
+} // namespace lens::onnx
\ No newline at end of file
@@ -2,15 +2,12 @@
 // Created by Shukant Pal on 5/26/23.
 //
 
-#include <onnxruntime/core/providers/coreml/coreml_provider_factory.h>
-#include <onnxruntime/core/session/onnxruntime_c_api.h>
-#include <onnxruntime/core/session/onnxruntime_cxx_api.h>
-
 #include "internal.h"
+#include "onnx.h"
 
 namespace fs = std::filesystem;
 
-namespace lens
+namespace lens::onnx
 {
 
 static const int NORM_FACE_DIM = 192;
@@ -60,19 +57,13 @@ void face_mesh_impl::run(const cv::Mat &face, cv::Mat &landmarks)
     cv::Mat(LDM_DIMS, LDM_COUNT, CV_32F, landmarks_ptr).copyTo(landmarks);
 }
 
-std::unique_ptr<face_mesh> face_mesh::build(const fs::path &path)
+std::unique_ptr<face_mesh> build_face_mesh(const fs::path &path)
 {
-    Ort::Env env(ORT_LOGGING_LEVEL_INFO, "FaceMesh");
-    Ort::SessionOptions session_options;
-
-#ifdef APPLE
-    OrtSessionOptionsAppendExecutionProvider_CoreML(session_options, COREML_FLAG_USE_NONE);
-#endif
-
+    Ort::SessionOptions session_options = onnx::session_options();
     std::string model_path = (path / "FaceMesh.onnx").string();
 
     return std::unique_ptr<face_mesh>(
-        new face_mesh_impl(new Ort::Session(env, model_path.c_str(), session_options)));
+        new face_mesh_impl(new Ort::Session(onnx::env(), model_path.c_str(), session_options)));
 }
 
-} // namespace lens
+} // namespace lens::onnx
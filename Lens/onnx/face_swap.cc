@@ -2,15 +2,15 @@
 // Created by Shukant Pal on 5/26/23.
 //
 
-#include <onnxruntime/core/providers/coreml/coreml_provider_factory.h>
-#include <onnxruntime/core/session/onnxruntime_c_api.h>
-#include <onnxruntime/core/session/onnxruntime_cxx_api.h>
+#include <iostream>
+#include <semaphore>
 
 #include "internal.h"
+#include "onnx.h"
 
 namespace fs = std::filesystem;
 
-namespace lens
+namespace lens::onnx
 {
 
 static constexpr size_t SWAP_DIM = 224;
@@ -31,18 +31,38 @@ class face_swap_impl : public face_swap
     explicit face_swap_impl(Ort::Session *);
     ~face_swap_impl() noexcept override;
     face2face *run(cv::Mat &) override;
+    void run_async(cv::Mat &, std::function<void(face2face *)>) override;
 
   private:
+    struct inference
+    {
+        face_swap_impl *self;
+        face2face *result;
+        cv::Mat in_face;
+        Ort::Value input_tensor;
+        std::vector<Ort::Value> output_tensors;
+        std::function<void(face2face *)> callback;
+    };
+
     std::unique_ptr<Ort::Session> session;
-};
+    std::counting_semaphore<MAX_INFERENCES_IN_FLIGHT> inferences_available;
 
-face_swap::~face_swap() = default;
+    static void run_async_callback(void *, OrtValue **, size_t, OrtStatusPtr);
+};
 
 face_swap_impl::face_swap_impl(Ort::Session *session) :
-    session(session)
+    session(session),
+    inferences_available(MAX_INFERENCES_IN_FLIGHT)
 { }
 
-face_swap_impl::~face_swap_impl() noexcept { }
+face_swap_impl::~face_swap_impl() noexcept
+{
+    stop_inference();
+
+    // RunAsync callbacks still use the session and the semaphore, and each returns its permit
+    for (int i = 0; i < MAX_INFERENCES_IN_FLIGHT; i++)
+        inferences_available.acquire();
+}
 
 face2face *face_swap_impl::run(cv::Mat &in_face)
 {
@@ -71,25 +91,101 @@ face2face *face_swap_impl::run(cv::Mat &in_face)
     float *out_celeb_face_ptr = out_celeb_face_tensor.GetTensorMutableData<float>();
     float *out_celeb_face_mask_ptr = out_celeb_face_mask_tensor.GetTensorMutableData<float>();
 
+    result->src_face = std::move(in_face);
     cv::Mat(SWAP_DIM, SWAP_DIM, CV_32FC3, out_celeb_face_ptr).copyTo(result->dst_face);
-    cv::Mat(224, 224, CV_32FC1, out_celeb_face_mask_ptr).copyTo(result->mask);
+    cv::Mat(SWAP_DIM, SWAP_DIM, CV_32FC1, out_celeb_face_mask_ptr).copyTo(result->mask);
 
     return result;
 }
 
-std::unique_ptr<face_swap> face_swap::build(const fs::path &path, const fs::path &_)
+void face_swap_impl::run_async(cv::Mat &in_face, std::function<void(face2face *)> callback)
 {
-    Ort::Env env(ORT_LOGGING_LEVEL_INFO, "FaceSwap");
-    Ort::SessionOptions session_options;
+    // Back-pressure the submitting worker only once every in-flight slot is taken
+    inferences_available.acquire();
 
-#ifdef APPLE
-    OrtSessionOptionsAppendExecutionProvider_CoreML(session_options, COREML_FLAG_USE_NONE);
-#endif
+    auto *job = new inference{
+        .self = this,
+        .result = nullptr,
+        .in_face = std::move(in_face),
+        .input_tensor = Ort::Value(nullptr),
+        .output_tensors = {},
+        .callback = std::move(callback),
+    };
 
+    if (!face2face_pool.try_pop(job->result))
+        job->result = new face2face();
+
+    Ort::MemoryInfo memory_info("Cpu", OrtDeviceAllocator, 0, OrtMemTypeDefault);
+    job->input_tensor =
+        Ort::Value::CreateTensor<float>(memory_info,
+                                        reinterpret_cast<float *>(job->in_face.data),
+                                        SWAP_DIM * SWAP_DIM * 3,
+                                        INPUT_TENSOR_SHAPE,
+                                        INPUT_TENSOR_RANK);
+    for (size_t i = 0; i < OUTPUT_TENSOR_COUNT; i++)
+        job->output_tensors.emplace_back(nullptr);
+
+    Ort::RunOptions run_options{nullptr};
+
+    try
+    {
+        session->RunAsync(run_options,
+                          &INPUT_TENSOR_NAME,
+                          &job->input_tensor,
+                          1,
+                          OUTPUT_TENSOR_NAMES,
+                          job->output_tensors.data(),
+                          OUTPUT_TENSOR_COUNT,
+                          face_swap_impl::run_async_callback,
+                          job);
+    }
+    catch (Ort::Exception &e)
+    {
+        // The callback is never invoked if the inference could not be scheduled
+        std::cerr << "Failed to submit face-swap inference: " << e.what() << std::endl;
+        face2face_pool.push(job->result);
+        inferences_available.release();
+        job->callback(nullptr);
+        delete job;
+    }
+}
+
+void face_swap_impl::run_async_callback(void *user_data,
+                                        OrtValue **,
+                                        size_t,
+                                        OrtStatusPtr status_ptr)
+{
+    std::unique_ptr<inference> job(reinterpret_cast<inference *>(user_data));
+    Ort::Status status(status_ptr);
+    face2face *result = job->result;
+
+    if (status.IsOK())
+    {
+        float *out_celeb_face_ptr = job->output_tensors[0].GetTensorMutableData<float>();
+        float *out_celeb_face_mask_ptr = job->output_tensors[1].GetTensorMutableData<float>();
+
+        result->src_face = std::move(job->in_face);
+        cv::Mat(SWAP_DIM, SWAP_DIM, CV_32FC3, out_celeb_face_ptr).copyTo(result->dst_face);
+        cv::Mat(SWAP_DIM, SWAP_DIM, CV_32FC1, out_celeb_face_mask_ptr).copyTo(result->mask);
+    }
+    else
+    {
+        std::cerr << "Failed to execute face-swap model: " << status.GetErrorMessage() << std::endl;
+        job->self->face2face_pool.push(result);
+        result = nullptr;
+    }
+
+    job->self->inferences_available.release();
+    job->callback(result);
+}
+
+std::unique_ptr<face_swap> build_face_swap(const fs::path &path, const fs::path &_)
+{
+    Ort::SessionOptions session_options = onnx::session_options();
     std::string path_str = path.string();
 
     return std::unique_ptr<face_swap>(
-        new face_swap_impl(new Ort::Session(env, path_str.c_str(), session_options)));
+        new face_swap_impl(new Ort::Session(onnx::env(), path_str.c_str(), session_options)));
 }
 
-} // namespace lens
\ No newline at end of file
+} // namespace lens::onnx
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "onnx.h"
+
+namespace lens::onnx
+{
+
+Ort::Env &env()
+{
+    static Ort::Env shared_env(ORT_LOGGING_LEVEL_WARNING, "Lens");
+    return shared_env;
+}
+
+Ort::SessionOptions session_options()
+{
+    Ort::SessionOptions options;
+#ifdef APPLE
+    OrtSessionOptionsAppendExecutionProvider_CoreML(options, COREML_FLAG_USE_NONE);
+#endif
+
+    return options;
+}
+
+} // namespace lens::onnx
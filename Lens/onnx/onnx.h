@@ -0,0 +1,28 @@
+#pragma once
+
+// Source builds of ONNX Runtime keep the repository layout, while release packages install its
+// headers flat into include/.
+#if __has_include(<onnxruntime/core/session/onnxruntime_cxx_api.h>)
+#include <onnxruntime/core/session/onnxruntime_c_api.h>
+#include <onnxruntime/core/session/onnxruntime_cxx_api.h>
+#ifdef APPLE
+#include <onnxruntime/core/providers/coreml/coreml_provider_factory.h>
+#endif
+#else
+#include <onnxruntime_c_api.h>
+#include <onnxruntime_cxx_api.h>
+#ifdef APPLE
+#include <coreml_provider_factory.h>
+#endif
+#endif
+
+namespace lens::onnx
+{
+
+/** The ONNX Runtime environment shared by all sessions, which must outlive them. */
+Ort::Env &env();
+
+/** Options for a new session, with the platform's preferred execution providers appended. */
+Ort::SessionOptions session_options();
+
+} // namespace lens::onnx
@@ -0,0 +1,85 @@
+#include "internal.h"
+#include "net_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace lens::opencv
+{
+
+static const int EXPECTED_ROWS = 480;
+static const int EXPECTED_COLS = 640;
+static const int EXPECTED_CHANNELS = 3;
+
+static const std::string INPUT_NAME = "input.1";
+static const int INPUT_BLOB_SHAPE[4] = {1, EXPECTED_ROWS, EXPECTED_COLS, EXPECTED_CHANNELS};
+static const std::vector<std::string> OUTPUT_NAMES = {"537", "538", "539", "540"};
+
+static const int OUT_ROWS = EXPECTED_ROWS / 4;
+static const int OUT_COLS = EXPECTED_COLS / 4;
+static const int OUT_LANDMARKS = 5;
+
+static const int NET_POOL_SIZE = 4;
+
+class center_face_impl : public center_face
+{
+  public:
+    explicit center_face_impl(const fs::path &model_path);
+    ~center_face_impl() noexcept override;
+    void run(const cv::Mat &image,
+             cv::Mat &heatmap,
+             std::tuple<cv::Mat, cv::Mat> &scales,
+             std::tuple<cv::Mat, cv::Mat> &offsets,
+             std::vector<cv::Mat> &landmarks) override;
+
+  private:
+    net_pool nets;
+};
+
+center_face_impl::center_face_impl(const fs::path &model_path) :
+    nets(model_path, NET_POOL_SIZE)
+{ }
+
+center_face_impl::~center_face_impl() noexcept { }
+
+void center_face_impl::run(const cv::Mat &image,
+                           cv::Mat &heatmap,
+                           std::tuple<cv::Mat, cv::Mat> &scales,
+                           std::tuple<cv::Mat, cv::Mat> &offsets,
+                           std::vector<cv::Mat> &landmarks)
+{
+    assert(image.cols == EXPECTED_COLS);
+    assert(image.rows == EXPECTED_ROWS);
+    assert(image.channels() == EXPECTED_CHANNELS);
+    assert(image.isContinuous());
+    assert(landmarks.size() == OUT_LANDMARKS * 2);
+
+    const cv::Mat input(4, INPUT_BLOB_SHAPE, CV_32F, image.data);
+    std::vector<cv::Mat> outputs;
+    nets.forward(INPUT_NAME, input, OUTPUT_NAMES, outputs);
+
+    auto *heatmap_ptr = reinterpret_cast<float *>(outputs[0].data);
+    auto *scales_ptr = reinterpret_cast<float *>(outputs[1].data);
+    auto *offsets_ptr = reinterpret_cast<float *>(outputs[2].data);
+    auto *landmarks_ptr = reinterpret_cast<float *>(outputs[3].data);
+
+    cv::Mat(OUT_ROWS, OUT_COLS, CV_32FC1, heatmap_ptr).copyTo(heatmap);
+    cv::Mat(OUT_ROWS, OUT_COLS, CV_32FC1, scales_ptr).copyTo(std::get<0>(scales));
+    cv::Mat(OUT_ROWS, OUT_COLS, CV_32FC1, scales_ptr + OUT_ROWS * OUT_COLS)
+        .copyTo(std::get<1>(scales));
+    cv::Mat(OUT_ROWS, OUT_COLS, CV_32FC1, offsets_ptr).copyTo(std::get<0>(offsets));
+    cv::Mat(OUT_ROWS, OUT_COLS, CV_32FC1, offsets_ptr + OUT_ROWS * OUT_COLS)
+        .copyTo(std::get<1>(offsets));
+
+    for (int i = 0; i < OUT_LANDMARKS * 2; i++)
+    {
+        cv::Mat(OUT_ROWS, OUT_COLS, CV_32FC1, landmarks_ptr + OUT_ROWS * OUT_COLS * i)
+            .copyTo(landmarks[i]);
+    }
+}
+
+std::unique_ptr<center_face> build_center_face(const fs::path &model_dir)
+{
+    return std::unique_ptr<center_face>(new center_face_impl(model_dir / "CenterFace.onnx"));
+}
+
+} // namespace lens::opencv
@@ -0,0 +1,51 @@
+#include "internal.h"
+#include "net_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace lens::opencv
+{
+
+static const std::string INPUT_NAME = "input_1";
+static const int INPUT_BLOB_SHAPE[4] = {1, 192, 192, 3};
+static const std::vector<std::string> OUTPUT_NAMES = {"conv2d_21"};
+
+static const int NET_POOL_SIZE = 4;
+
+class face_mesh_impl : public face_mesh
+{
+  public:
+    explicit face_mesh_impl(const fs::path &model_path);
+    ~face_mesh_impl() noexcept override;
+    void run(const cv::Mat &face, cv::Mat &landmarks) override;
+
+  private:
+    net_pool nets;
+};
+
+face_mesh_impl::face_mesh_impl(const fs::path &model_path) :
+    nets(model_path, NET_POOL_SIZE)
+{ }
+
+face_mesh_impl::~face_mesh_impl() noexcept { }
+
+void face_mesh_impl::run(const cv::Mat &face, cv::Mat &landmarks)
+{
+    assert(face.channels() == 3);
+    assert(face.rows == NORM_FACE_DIM);
+    assert(face.cols == NORM_FACE_DIM);
+    assert(face.isContinuous());
+
+    const cv::Mat input(4, INPUT_BLOB_SHAPE, CV_32F, face.data);
+    std::vector<cv::Mat> outputs;
+    nets.forward(INPUT_NAME, input, OUTPUT_NAMES, outputs);
+
+    cv::Mat(LDM_DIMS, LDM_COUNT, CV_32F, outputs[0].data).copyTo(landmarks);
+}
+
+std::unique_ptr<face_mesh> build_face_mesh(const fs::path &model_dir)
+{
+    return std::unique_ptr<face_mesh>(new face_mesh_impl(model_dir / "FaceMesh.onnx"));
+}
+
+} // namespace lens::opencv
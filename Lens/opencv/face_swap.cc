@@ -0,0 +1,63 @@
+#include "internal.h"
+#include "net_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace lens::opencv
+{
+
+static constexpr int SWAP_DIM = 224;
+
+static const std::string INPUT_NAME = "in_face:0";
+static const int INPUT_BLOB_SHAPE[4] = {1, SWAP_DIM, SWAP_DIM, 3};
+static const std::vector<std::string> OUTPUT_NAMES = {
+    "out_celeb_face:0",
+    "out_celeb_face_mask:0",
+};
+
+// run() is only called from the single inference thread, so a second network would sit unused
+static const int NET_POOL_SIZE = 1;
+
+class face_swap_impl : public face_swap
+{
+  public:
+    explicit face_swap_impl(const fs::path &model_path);
+    ~face_swap_impl() noexcept override;
+    face2face *run(cv::Mat &) override;
+
+  private:
+    net_pool nets;
+};
+
+face_swap_impl::face_swap_impl(const fs::path &model_path) :
+    nets(model_path, NET_POOL_SIZE)
+{ }
+
+face_swap_impl::~face_swap_impl() noexcept { stop_inference(); }
+
+face2face *face_swap_impl::run(cv::Mat &in_face)
+{
+    assert(in_face.rows == SWAP_DIM && in_face.cols == SWAP_DIM);
+    assert(in_face.isContinuous());
+
+    face2face *result = nullptr;
+    if (!face2face_pool.try_pop(result))
+        result = new face2face();
+
+    const cv::Mat input(4, INPUT_BLOB_SHAPE, CV_32F, in_face.data);
+    std::vector<cv::Mat> outputs;
+    nets.forward(INPUT_NAME, input, OUTPUT_NAMES, outputs);
+
+    result->src_face = std::move(in_face);
+    cv::Mat(SWAP_DIM, SWAP_DIM, CV_32FC3, outputs[0].data).copyTo(result->dst_face);
+    cv::Mat(SWAP_DIM, SWAP_DIM, CV_32FC1, outputs[1].data).copyTo(result->mask);
+
+    return result;
+}
+
+std::unique_ptr<face_swap> build_face_swap(const fs::path &model_path, const fs::path &)
+{
+    return std::unique_ptr<face_swap>(new face_swap_impl(model_path));
+}
+
+} // namespace lens::opencv
@@ -0,0 +1,42 @@
+#include "internal.h"
+
+namespace lens
+{
+
+class gaussian_blur_impl : public gaussian_blur
+{
+  public:
+    gaussian_blur_impl();
+    ~gaussian_blur_impl() noexcept override;
+    double get_radius() override;
+    void set_radius(double) override;
+    void run(cv::Mat &in, cv::Mat &out) override;
+
+  private:
+    double radius;
+};
+
+gaussian_blur::~gaussian_blur() noexcept { }
+
+std::unique_ptr<gaussian_blur> gaussian_blur::build()
+{
+    return std::unique_ptr<gaussian_blur>(new gaussian_blur_impl());
+}
+
+gaussian_blur_impl::gaussian_blur_impl() :
+    radius(0)
+{ }
+
+gaussian_blur_impl::~gaussian_blur_impl() noexcept { }
+
+double gaussian_blur_impl::get_radius() { return radius; }
+
+void gaussian_blur_impl::set_radius(double value) { this->radius = value; }
+
+void gaussian_blur_impl::run(cv::Mat &in, cv::Mat &out)
+{
+    // Like MPSImageGaussianBlur, the radius is the standard deviation and the kernel is sized to it
+    cv::GaussianBlur(in, out, cv::Size(0, 0), radius, radius, cv::BORDER_CONSTANT);
+}
+
+} // namespace lens
@@ -0,0 +1,49 @@
+#include "net_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace lens::opencv
+{
+
+net_pool::net_pool(const fs::path &model_path, int size) :
+    nets()
+{
+    if (!fs::exists(model_path))
+        throw std::runtime_error("The model " + model_path.string() + " does not exist");
+
+    for (int i = 0; i < size; i++)
+    {
+        cv::dnn::Net net = cv::dnn::readNetFromONNX(model_path.string());
+        net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+        net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+        nets.push(net);
+    }
+}
+
+void net_pool::forward(const std::string &input_name,
+                       const cv::Mat &input,
+                       const std::vector<std::string> &output_names,
+                       std::vector<cv::Mat> &outputs)
+{
+    cv::dnn::Net net;
+    nets.pop(net);
+
+    try
+    {
+        net.setInput(input, input_name);
+        net.forward(outputs, output_names);
+
+        // Outputs alias the network's blobs, which the next borrower would overwrite
+        for (auto &output : outputs)
+            output = output.clone();
+    }
+    catch (...)
+    {
+        nets.push(net);
+        throw;
+    }
+
+    nets.push(net);
+}
+
+} // namespace lens::opencv
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <filesystem>
+#include <oneapi/tbb.h>
+#include <opencv2/dnn.hpp>
+#include <string>
+#include <vector>
+
+namespace lens::opencv
+{
+
+/**
+ * cv::dnn::Net is not safe to run from several threads at once, so each model keeps a pool of
+ * independently loaded networks that pipeline workers borrow for a single forward pass.
+ */
+class net_pool
+{
+  public:
+    net_pool(const std::filesystem::path &model_path, int size);
+
+    void forward(const std::string &input_name,
+                 const cv::Mat &input,
+                 const std::vector<std::string> &output_names,
+                 std::vector<cv::Mat> &outputs);
+
+  private:
+    oneapi::tbb::concurrent_bounded_queue<cv::dnn::Net> nets;
+};
+
+} // namespace lens::opencv
@@ -0,0 +1,1593 @@
+//
+//  facade.cc
+//  libfacade
+//
+//  libfacade for Linux. There is no system extension here: the device registry is a small
+//  shared-memory table guarded by a robust process-shared mutex, and each device's frames move
+//  through a shared-memory ring of slots that writers and readers in any process map directly.
+//  Readiness is signalled with futexes on words inside the shared memory.
+//
+
+#include "facade.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <mutex>
+#include <optional>
+#include <pthread.h>
+#include <random>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+const char *REGISTRY_NAME = "/facade.registry";
+const char *RING_PREFIX = "/facade.";
+
+constexpr uint32_t REGISTRY_VERSION = 1;
+constexpr uint32_t RING_MAGIC = 0x326e7266; // "frn2"
+constexpr int MAX_DEVICES = 32;
+constexpr int UID_LENGTH = 40;
+constexpr int NAME_LENGTH = 128;
+/** A power of two, so slot indices stay consistent when the commit counter wraps. */
+constexpr uint32_t RING_SLOTS = 4;
+/** How many leases can hold one slot at once, across every reading process. */
+constexpr int MAX_SLOT_READERS = 8;
+constexpr size_t PAGE_SIZE = 4096;
+constexpr long WAIT_TIMEOUT_NS = 100'000'000;
+constexpr int OPEN_ATTEMPTS = 100;
+
+struct registry_entry
+{
+    uint32_t in_use;
+    /** Bumped whenever the entry's configuration changes. */
+    uint32_t generation;
+    char uid[UID_LENGTH];
+    char name[NAME_LENGTH];
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_rate;
+};
+
+struct registry
+{
+    std::atomic<uint32_t> ready;
+    uint32_t version;
+    pthread_mutex_t lock;
+    /** Bumped and woken whenever any entry changes. */
+    std::atomic<uint32_t> generation;
+    registry_entry devices[MAX_DEVICES];
+};
+
+struct ring_slot
+{
+    /** The commit count that filled this slot, or 0 while it is being written. */
+    std::atomic<uint32_t> sequence;
+    /** The process holding each lease on the slot, or 0, so a dead reader's lease can be cleared. */
+    std::atomic<int32_t> readers[MAX_SLOT_READERS];
+    uint64_t timestamp;
+};
+
+/**
+ * The header at the start of a device's ring. One writer fills the slot with the oldest frame that
+ * no reader holds, and readers copy or borrow the most recently committed slot.
+ */
+struct ring
+{
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t slot_count;
+    uint64_t slot_size;
+    uint64_t data_offset;
+    /** Frames committed so far; woken on every commit. */
+    std::atomic<uint32_t> commits;
+    /** Bumped and woken whenever a reader lets go of a slot. */
+    std::atomic<uint32_t> releases;
+    std::atomic<int32_t> writer_pid;
+    ring_slot slots[RING_SLOTS];
+};
+
+/** A slot handed out by an acquire call, held until it is committed or released. */
+struct slot_lease
+{
+    ring *header = nullptr;
+    uint32_t index = 0;
+    uint32_t sequence = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint8_t *data = nullptr;
+    /** The commit whose frame the slot held when it was acquired, or 0 if it held none. */
+    uint32_t contents = 0;
+    /** The entry of the slot's readers that a read lease holds. */
+    int reader = 0;
+};
+
+/** The rectangles a committed frame changed, or the whole frame if they are not known. */
+struct frame_damage
+{
+    uint32_t sequence;
+    bool whole;
+    std::vector<facade_rect> rects;
+};
+
+registry *shared_registry = nullptr;
+
+std::mutex listener_mutex;
+std::once_flag listener_once;
+facade_callback state_changed_callback = nullptr;
+void *state_changed_context = nullptr;
+std::vector<facade_device *> watched_devices;
+
+/** Bumped whenever the registry changes, which marks the cached copy of it stale. */
+std::atomic<uint64_t> state_version = 1;
+std::mutex cache_mutex;
+std::vector<registry_entry> cached_entries;
+uint64_t cached_version = 0;
+
+void log_error(const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    std::fputs("libfacade: ", stderr);
+    std::vfprintf(stderr, format, arguments);
+    std::fputc('\n', stderr);
+    va_end(arguments);
+}
+
+void futex_wait(std::atomic<uint32_t> *word, uint32_t expected, long timeout_ns)
+{
+    timespec timeout = {0, timeout_ns};
+    syscall(SYS_futex,
+            reinterpret_cast<uint32_t *>(word),
+            FUTEX_WAIT,
+            expected,
+            timeout_ns > 0 ? &timeout : nullptr,
+            nullptr,
+            0);
+}
+
+void futex_wake(std::atomic<uint32_t> *word)
+{
+    syscall(
+        SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+uint64_t monotonic_ns()
+{
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1'000'000'000 + now.tv_nsec;
+}
+
+size_t round_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+std::string ring_name(const char *uid)
+{
+    return std::string(RING_PREFIX) + uid;
+}
+
+std::string generate_uid()
+{
+    std::random_device source;
+    char uid[UID_LENGTH];
+
+    std::snprintf(uid,
+                  sizeof(uid),
+                  "%08x-%04x-%04x-%04x-%04x%08x",
+                  source(),
+                  source() & 0xffff,
+                  source() & 0xffff,
+                  source() & 0xffff,
+                  source() & 0xffff,
+                  source());
+
+    return uid;
+}
+
+/** Holds the registry's cross-process lock, recovering it if its last owner died. */
+class registry_lock
+{
+  public:
+    registry_lock()
+    {
+        if (pthread_mutex_lock(&shared_registry->lock) == EOWNERDEAD)
+            pthread_mutex_consistent(&shared_registry->lock);
+    }
+
+    ~registry_lock() { pthread_mutex_unlock(&shared_registry->lock); }
+};
+
+void publish_registry_change()
+{
+    // The listener will see the change too, but this process's own lookups must see it at once
+    state_version.fetch_add(1);
+    shared_registry->generation.fetch_add(1);
+    futex_wake(&shared_registry->generation);
+}
+
+facade_error_code open_registry()
+{
+    bool created = true;
+    int fd = shm_open(REGISTRY_NAME, O_RDWR | O_CREAT | O_EXCL, 0666);
+
+    if (fd < 0 && errno == EEXIST)
+    {
+        created = false;
+        fd = shm_open(REGISTRY_NAME, O_RDWR, 0);
+    }
+    if (fd < 0)
+        return facade_error_not_installed;
+
+    if (created)
+    {
+        fchmod(fd, 0666);
+        if (ftruncate(fd, sizeof(registry)) < 0)
+        {
+            close(fd);
+            shm_unlink(REGISTRY_NAME);
+            return facade_error_not_installed;
+        }
+    }
+    else
+    {
+        // The process that created the registry may not have sized it yet
+        struct stat info{};
+        for (int i = 0; i < OPEN_ATTEMPTS && fstat(fd, &info) == 0 &&
+                        static_cast<size_t>(info.st_size) < sizeof(registry);
+             i++)
+            usleep(10'000);
+    }
+
+    void *mapping = mmap(nullptr, sizeof(registry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        return facade_error_not_installed;
+
+    auto *shared = static_cast<registry *>(mapping);
+
+    if (created)
+    {
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&shared->lock, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+
+        shared->version = REGISTRY_VERSION;
+        shared->ready.store(1);
+    }
+    else
+    {
+        for (int i = 0; i < OPEN_ATTEMPTS && shared->ready.load() == 0; i++)
+            usleep(10'000);
+    }
+
+    if (shared->ready.load() == 0 || shared->version != REGISTRY_VERSION)
+    {
+        munmap(mapping, sizeof(registry));
+        return facade_error_protocol;
+    }
+
+    shared_registry = shared;
+    return facade_error_none;
+}
+
+/** Copy the devices in the registry, so callers need not hold its lock while using them. */
+std::vector<registry_entry> snapshot_registry()
+{
+    std::vector<registry_entry> entries;
+    registry_lock lock;
+
+    for (const auto &entry : shared_registry->devices)
+        if (entry.in_use)
+            entries.push_back(entry);
+
+    return entries;
+}
+
+/** The devices in the registry, re-read only if it changed since they were last read. */
+std::vector<registry_entry> cached_registry(uint64_t *version = nullptr)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    const uint64_t current = state_version.load();
+
+    if (cached_version != current)
+    {
+        cached_entries = snapshot_registry();
+        cached_version = current;
+    }
+
+    if (version != nullptr)
+        *version = cached_version;
+
+    return cached_entries;
+}
+
+/** Copy registry entries into a new state, in the registry's order. */
+facade_state *read_state(const std::vector<registry_entry> &entries)
+{
+    auto *state = static_cast<facade_state *>(calloc(1, sizeof(facade_state)));
+    state->api_version = REGISTRY_VERSION;
+    facade_device_info *last = nullptr;
+
+    for (const auto &entry : entries)
+    {
+        auto *info = static_cast<facade_device_info *>(calloc(1, sizeof(facade_device_info)));
+        info->type = facade_device_type_video;
+        info->uid = strdup(entry.uid);
+        info->name = strdup(entry.name);
+        info->width = entry.width;
+        info->height = entry.height;
+        info->frame_rate = entry.frame_rate;
+
+        if (last == nullptr)
+            state->devices = info;
+        else
+            last->next = info;
+
+        info->next = state->devices;
+        last = info;
+    }
+
+    return state;
+}
+
+registry_entry *find_entry(const char *uid)
+{
+    for (auto &entry : shared_registry->devices)
+        if (entry.in_use && std::strcmp(entry.uid, uid) == 0)
+            return &entry;
+
+    return nullptr;
+}
+
+bool valid_options(const facade_device_info *options)
+{
+    return options->type == facade_device_type_video && options->name != nullptr &&
+           options->width <= 8192 && options->height <= 8192 && options->frame_rate >= 10 &&
+           options->frame_rate <= 120;
+}
+
+void write_entry(registry_entry &entry, const facade_device_info *options)
+{
+    std::snprintf(entry.name, sizeof(entry.name), "%s", options->name);
+    entry.width = options->width;
+    entry.height = options->height;
+    entry.frame_rate = options->frame_rate;
+    entry.generation++;
+}
+
+void insert_device(facade_device **list, facade_device *node)
+{
+    if (*list == nullptr)
+    {
+        *list = node;
+        node->next = node;
+    }
+    else
+    { // insert after list head and shift
+        node->next = (*list)->next;
+        (*list)->next = node;
+        *list = node;
+    }
+}
+
+void dispose_device_info(facade_device_info **node_ref)
+{
+    facade_device_info *node = *node_ref;
+
+    free(const_cast<char *>(node->uid));
+    free(const_cast<char *>(node->name));
+    free(node);
+
+    *node_ref = nullptr;
+}
+
+} // namespace
+
+struct facade_device_data
+{
+    uint32_t generation = 0;
+
+    std::mutex callback_mutex;
+    facade_callback read_callback = nullptr;
+    void *read_context = nullptr;
+    facade_callback write_callback = nullptr;
+    void *write_context = nullptr;
+    facade_callback changed_callback = nullptr;
+    void *changed_context = nullptr;
+
+    std::atomic<ring *> read_ring{nullptr};
+    size_t read_ring_size = 0;
+    std::atomic<ring *> write_ring{nullptr};
+    size_t write_ring_size = 0;
+    /** Mappings replaced after a resize, kept until close in case a thread still uses them. */
+    std::vector<std::pair<ring *, size_t>> retired_rings;
+
+    std::atomic<bool> reading{false};
+    std::atomic<bool> writing{false};
+    std::thread read_thread;
+    std::thread write_thread;
+
+    uint32_t last_read = 0;
+    slot_lease read_lease;
+    slot_lease write_lease;
+    /** What each of the latest commits changed, so a slot can catch up on the frames it missed. */
+    std::deque<frame_damage> write_damage;
+    void *read_frame = nullptr;
+    size_t read_frame_size = 0;
+};
+
+namespace
+{
+
+size_t slot_size(uint32_t width, uint32_t height)
+{
+    return round_up(static_cast<size_t>(BYTES_PER_PIXEL) * width * height, PAGE_SIZE);
+}
+
+size_t ring_size(uint32_t width, uint32_t height)
+{
+    return round_up(sizeof(ring), PAGE_SIZE) + slot_size(width, height) * RING_SLOTS;
+}
+
+uint8_t *slot_data(ring *header, uint32_t index)
+{
+    return reinterpret_cast<uint8_t *>(header) + header->data_offset + index * header->slot_size;
+}
+
+/**
+ * Map the device's ring at its current geometry, creating or growing the shared memory behind it
+ * if needed. The ring is never shrunk, so other processes' mappings stay valid.
+ */
+facade_error_code map_ring(facade_device *device, ring **header, size_t *size)
+{
+    const size_t required = ring_size(device->width, device->height);
+    const std::string name = ring_name(device->uid);
+    registry_lock lock;
+
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+    {
+        log_error("%s - Failed to open the frame ring (%s)", device->uid, strerror(errno));
+        return facade_error_unknown;
+    }
+
+    fchmod(fd, 0666);
+
+    struct stat info{};
+    if (fstat(fd, &info) < 0 ||
+        (static_cast<size_t>(info.st_size) < required && ftruncate(fd, required) < 0))
+    {
+        log_error("%s - Failed to size the frame ring (%s)", device->uid, strerror(errno));
+        close(fd);
+        return facade_error_unknown;
+    }
+
+    const size_t mapped_size = std::max(required, static_cast<size_t>(info.st_size));
+    void *mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        log_error("%s - Failed to map the frame ring (%s)", device->uid, strerror(errno));
+        return facade_error_unknown;
+    }
+
+    auto *shared = static_cast<ring *>(mapping);
+
+    if (shared->magic != RING_MAGIC || shared->width != device->width ||
+        shared->height != device->height)
+    {
+        // Frames of the old geometry are dropped; the counters carry on so waiters still wake
+        for (auto &slot : shared->slots)
+        {
+            slot.sequence.store(0);
+
+            // A ring laid out by another version has no leases that can be trusted
+            if (shared->magic != RING_MAGIC)
+                for (auto &reader : slot.readers)
+                    reader.store(0);
+        }
+
+        shared->width = device->width;
+        shared->height = device->height;
+        shared->slot_count = RING_SLOTS;
+        shared->slot_size = slot_size(device->width, device->height);
+        shared->data_offset = round_up(sizeof(ring), PAGE_SIZE);
+        shared->magic = RING_MAGIC;
+    }
+
+    *header = shared;
+    *size = mapped_size;
+
+    return facade_error_none;
+}
+
+/** Remap a ring that no longer matches the device's geometry. */
+facade_error_code refresh_ring(facade_device *device, std::atomic<ring *> &current, size_t &size)
+{
+    ring *header = current.load();
+
+    if (header != nullptr && header->magic == RING_MAGIC && header->width == device->width &&
+        header->height == device->height && ring_size(header->width, header->height) <= size)
+        return facade_error_none;
+
+    ring *remapped = nullptr;
+    size_t remapped_size = 0;
+    const facade_error_code code = map_ring(device, &remapped, &remapped_size);
+
+    if (code != facade_error_none)
+        return code;
+
+    if (header != nullptr)
+        device->data->retired_rings.emplace_back(header, size);
+
+    current.store(remapped);
+    size = remapped_size;
+
+    return facade_error_none;
+}
+
+void notify(facade_device_data *data, facade_callback facade_device_data::*callback,
+            void *facade_device_data::*context)
+{
+    facade_callback target;
+    void *target_context;
+    {
+        std::lock_guard<std::mutex> lock(data->callback_mutex);
+        target = data->*callback;
+        target_context = data->*context;
+    }
+
+    if (target != nullptr)
+        target(target_context);
+}
+
+/** Whether no reader holds the slot, after clearing the leases of readers that died holding it. */
+bool slot_unread(ring_slot &slot)
+{
+    bool unread = true;
+
+    for (auto &reader : slot.readers)
+    {
+        int32_t pid = reader.load();
+        if (pid == 0)
+            continue;
+        if (kill(pid, 0) != 0 && errno == ESRCH && reader.compare_exchange_strong(pid, 0))
+            continue;
+
+        unread = false;
+    }
+
+    return unread;
+}
+
+/**
+ * The slot holding the oldest frame that no reader holds, or -1 if every slot is held. The newest
+ * frame is never chosen, so readers always have a frame to claim.
+ */
+int next_write_slot(ring *header)
+{
+    const uint32_t commits = header->commits.load();
+    int chosen = -1;
+    uint32_t chosen_age = 0;
+
+    for (uint32_t index = 0; index < RING_SLOTS; index++)
+    {
+        ring_slot &slot = header->slots[index];
+        const uint32_t sequence = slot.sequence.load();
+
+        if ((sequence != 0 && sequence == commits) || !slot_unread(slot))
+            continue;
+
+        // A slot without a frame is older than any
+        const uint32_t age = sequence == 0 ? UINT32_MAX : commits - sequence;
+        if (chosen < 0 || age > chosen_age)
+        {
+            chosen = static_cast<int>(index);
+            chosen_age = age;
+        }
+    }
+
+    return chosen;
+}
+
+/** Calls the read callback whenever a frame is committed to the ring after the seen count. */
+void run_reader(facade_device *device, uint32_t seen)
+{
+    facade_device_data *data = device->data;
+
+    while (data->reading)
+    {
+        ring *header = data->read_ring.load();
+        futex_wait(&header->commits, seen, WAIT_TIMEOUT_NS);
+
+        const uint32_t commits = header->commits.load();
+        if (commits == seen)
+            continue;
+
+        seen = commits;
+        notify(data, &facade_device_data::read_callback, &facade_device_data::read_context);
+    }
+}
+
+/** Calls the write callback after each commit, once the slot for the next frame is free. */
+void run_writer(facade_device *device, uint32_t seen)
+{
+    facade_device_data *data = device->data;
+
+    while (data->writing)
+    {
+        ring *header = data->write_ring.load();
+        futex_wait(&header->commits, seen, WAIT_TIMEOUT_NS);
+
+        const uint32_t commits = header->commits.load();
+        if (commits == seen)
+            continue;
+
+        seen = commits;
+
+        // The next frame needs a slot that slow readers are not still copying
+        uint32_t releases = header->releases.load();
+
+        while (data->writing && next_write_slot(header) < 0)
+        {
+            futex_wait(&header->releases, releases, WAIT_TIMEOUT_NS);
+            releases = header->releases.load();
+        }
+
+        if (data->writing)
+            notify(data, &facade_device_data::write_callback, &facade_device_data::write_context);
+    }
+}
+
+/** Dispatches registry changes to the state listener and to every device still in use. */
+void listen_for_changes(uint32_t seen)
+{
+    while (true)
+    {
+        futex_wait(&shared_registry->generation, seen, 0);
+
+        const uint32_t generation = shared_registry->generation.load();
+        if (generation == seen)
+            continue;
+
+        seen = generation;
+        state_version.fetch_add(1);
+        const std::vector<registry_entry> entries = snapshot_registry();
+        std::vector<std::pair<facade_callback, void *>> callbacks;
+
+        {
+            std::lock_guard<std::mutex> lock(listener_mutex);
+
+            if (state_changed_callback != nullptr)
+                callbacks.emplace_back(state_changed_callback, state_changed_context);
+
+            for (facade_device *device : watched_devices)
+            {
+                for (const auto &entry : entries)
+                {
+                    if (std::strcmp(entry.uid, device->uid) != 0 ||
+                        entry.generation == device->data->generation)
+                        continue;
+
+                    device->data->generation = entry.generation;
+                    device->width = entry.width;
+                    device->height = entry.height;
+                    device->frame_rate = entry.frame_rate;
+
+                    std::lock_guard<std::mutex> callback_lock(device->data->callback_mutex);
+                    if (device->data->changed_callback != nullptr)
+                        callbacks.emplace_back(device->data->changed_callback,
+                                               device->data->changed_context);
+                }
+            }
+        }
+
+        // Callbacks may find or dispose of devices, which takes the listener lock
+        for (const auto &[callback, context] : callbacks)
+            callback(context);
+    }
+}
+
+facade_device *read_device(const registry_entry &entry)
+{
+    auto *device = static_cast<facade_device *>(calloc(1, sizeof(facade_device)));
+    device->type = facade_device_type_video;
+    device->uid = strdup(entry.uid);
+    device->name = strdup(entry.name);
+    device->width = entry.width;
+    device->height = entry.height;
+    device->frame_rate = entry.frame_rate;
+    device->data = new facade_device_data();
+    device->data->generation = entry.generation;
+
+    std::lock_guard<std::mutex> lock(listener_mutex);
+    watched_devices.push_back(device);
+
+    return device;
+}
+
+/** Take an entry in the slot's readers for this process, or return -1 if every one is taken. */
+int claim_slot(ring_slot &slot)
+{
+    const int32_t pid = getpid();
+
+    for (int reader = 0; reader < MAX_SLOT_READERS; reader++)
+    {
+        int32_t empty = 0;
+        if (slot.readers[reader].compare_exchange_strong(empty, pid))
+            return reader;
+    }
+
+    return -1;
+}
+
+void release_slot(ring *header, ring_slot &slot, int reader)
+{
+    slot.readers[reader].store(0);
+    header->releases.fetch_add(1);
+    futex_wake(&header->releases);
+}
+
+/**
+ * Publish the acquired slot. The rectangles it changed since the previous frame are remembered
+ * for damaged writes to later slots, or the whole frame if damage is null.
+ */
+facade_error_code commit_frame(facade_device *device,
+                               void *buffer,
+                               uint64_t timestamp,
+                               const std::vector<facade_rect> *damage)
+{
+    facade_device_data *data = device->data;
+    slot_lease &lease = data->write_lease;
+
+    if (lease.data == nullptr || lease.data != buffer)
+    {
+        log_error("facade_write_commit %s - The buffer was not acquired.", device->uid);
+        return facade_error_invalid_input;
+    }
+
+    ring *header = lease.header;
+    ring_slot &slot = header->slots[lease.index];
+    const uint32_t sequence = lease.sequence;
+    const bool resized = header->width != lease.width || header->height != lease.height;
+    lease = {};
+
+    // A reader resizing the ring cleared every slot, including this one
+    if (resized)
+    {
+        data->write_damage.clear();
+        return facade_error_invalid_state;
+    }
+
+    slot.timestamp = timestamp != 0 ? timestamp : monotonic_ns();
+    slot.sequence.store(sequence);
+
+    // Rectangles are relative to the caller's previous frame, which must be the commit before
+    const bool whole = damage == nullptr || data->write_damage.empty() ||
+                       data->write_damage.back().sequence != sequence - 1;
+
+    data->write_damage.push_back(
+        {sequence, whole, whole ? std::vector<facade_rect>() : *damage});
+    while (data->write_damage.size() > RING_SLOTS)
+        data->write_damage.pop_front();
+
+    header->commits.store(sequence);
+    futex_wake(&header->commits);
+
+    return facade_error_none;
+}
+
+/**
+ * The rectangles to copy into the leased slot to bring the frame it holds up to date, or nullopt
+ * if it must be copied whole.
+ */
+std::optional<std::vector<facade_rect>> catch_up(const facade_device_data *data,
+                                                 const std::vector<facade_rect> &damage)
+{
+    const slot_lease &lease = data->write_lease;
+    std::vector<facade_rect> rects = damage;
+    uint32_t missed = 0;
+
+    if (lease.contents == 0)
+        return std::nullopt;
+
+    // The slot missed every frame committed after the one it holds, each of which must be known
+    for (const frame_damage &frame : data->write_damage)
+    {
+        if (frame.sequence - lease.contents - 1 >= lease.sequence - lease.contents - 1)
+            continue;
+        if (frame.whole)
+            return std::nullopt;
+
+        rects.insert(rects.end(), frame.rects.begin(), frame.rects.end());
+        missed++;
+    }
+
+    if (missed != lease.sequence - lease.contents - 1)
+        return std::nullopt;
+
+    return rects;
+}
+
+} // namespace
+
+facade_error_code facade_init(void)
+{
+    if (shared_registry == nullptr)
+    {
+        const facade_error_code code = open_registry();
+        if (code != facade_error_none)
+            return code;
+    }
+
+    // Changes made before the listener thread starts must still mark the cache stale
+    std::call_once(listener_once,
+                   []
+                   {
+                       const uint32_t seen = shared_registry->generation.load();
+                       std::thread(listen_for_changes, seen).detach();
+                   });
+
+    return facade_error_none;
+}
+
+facade_error_code facade_read_state(facade_state **p)
+{
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    *p = read_state(snapshot_registry());
+    return facade_error_none;
+}
+
+facade_error_code facade_write_state(facade_state *p)
+{
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    std::vector<std::string> removed;
+    {
+        registry_lock lock;
+        bool kept[MAX_DEVICES] = {};
+        facade_device_info *info = p->devices;
+
+        // Check every device before touching the registry, so a bad one leaves it unchanged
+        if (info != nullptr)
+        {
+            do
+            {
+                if (!valid_options(info))
+                    return facade_error_invalid_input;
+                info = info->next;
+            }
+            while (info != nullptr && info != p->devices);
+        }
+
+        info = p->devices;
+
+        if (info != nullptr)
+        {
+            do
+            {
+                registry_entry *entry = info->uid != nullptr ? find_entry(info->uid) : nullptr;
+
+                if (entry == nullptr)
+                {
+                    for (auto &candidate : shared_registry->devices)
+                    {
+                        if (!candidate.in_use)
+                        {
+                            entry = &candidate;
+                            break;
+                        }
+                    }
+
+                    if (entry == nullptr)
+                    {
+                        log_error("facade_write_state - Too many devices (%i)", MAX_DEVICES);
+                        return facade_error_unknown;
+                    }
+
+                    const std::string uid = info->uid != nullptr ? info->uid : generate_uid();
+                    std::snprintf(entry->uid, sizeof(entry->uid), "%s", uid.c_str());
+                    entry->in_use = 1;
+                }
+
+                write_entry(*entry, info);
+                kept[entry - shared_registry->devices] = true;
+                info = info->next;
+            }
+            while (info != nullptr && info != p->devices);
+        }
+
+        for (int i = 0; i < MAX_DEVICES; i++)
+        {
+            if (shared_registry->devices[i].in_use && !kept[i])
+            {
+                shared_registry->devices[i].in_use = 0;
+                removed.push_back(ring_name(shared_registry->devices[i].uid));
+            }
+        }
+    }
+
+    // Processes that still map a removed device's ring keep it until they close it
+    for (const auto &name : removed)
+        shm_unlink(name.c_str());
+
+    publish_registry_change();
+    return facade_error_none;
+}
+
+facade_error_code facade_on_state_changed(facade_callback callback, void *context)
+{
+    std::lock_guard<std::mutex> lock(listener_mutex);
+    state_changed_callback = callback;
+    state_changed_context = context;
+
+    return facade_error_none;
+}
+
+facade_error_code facade_state_version(uint64_t *version)
+{
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    *version = state_version.load();
+    return facade_error_none;
+}
+
+facade_error_code facade_read_cached_state(facade_state **p, uint64_t *version)
+{
+    *p = nullptr;
+
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    uint64_t current = 0;
+    const std::vector<registry_entry> entries = cached_registry(&current);
+
+    if (*version != current)
+    {
+        *p = read_state(entries);
+        *version = current;
+    }
+
+    return facade_error_none;
+}
+
+facade_error_code facade_dispose_state(facade_state **p)
+{
+    facade_device_info *device_info = (*p)->devices;
+
+    if (device_info != nullptr)
+    {
+        do
+        {
+            facade_device_info *next = device_info->next;
+            dispose_device_info(&device_info);
+            device_info = next;
+        }
+        while (device_info != (*p)->devices);
+    }
+
+    free(*p);
+    *p = nullptr;
+
+    return facade_error_none;
+}
+
+facade_error_code facade_list_devices(facade_device **p)
+{
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    for (const auto &entry : snapshot_registry())
+        insert_device(p, read_device(entry));
+
+    return facade_error_none;
+}
+
+facade_error_code facade_find_device_by_uid(char const *uid, facade_device **p)
+{
+    *p = nullptr;
+
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    for (const auto &entry : cached_registry())
+    {
+        if (std::strcmp(entry.uid, uid) == 0)
+        {
+            *p = read_device(entry);
+            break;
+        }
+    }
+
+    return *p != nullptr ? facade_error_none : facade_error_not_found;
+}
+
+facade_error_code facade_find_device_by_name(char const *name, facade_device **p)
+{
+    *p = nullptr;
+
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    for (const auto &entry : cached_registry())
+    {
+        if (std::strcmp(entry.name, name) == 0)
+        {
+            *p = read_device(entry);
+            break;
+        }
+    }
+
+    return *p != nullptr ? facade_error_none : facade_error_not_found;
+}
+
+facade_error_code facade_dispose_device(facade_device **p)
+{
+    facade_device *device = *p;
+
+    if (device->data->reading)
+        facade_read_close(device);
+    if (device->data->writing)
+        facade_write_close(device);
+
+    {
+        std::lock_guard<std::mutex> lock(listener_mutex);
+        std::erase(watched_devices, device);
+    }
+
+    facade_device_data *data = device->data;
+
+    if (data->read_ring.load() != nullptr)
+        munmap(data->read_ring.load(), data->read_ring_size);
+    if (data->write_ring.load() != nullptr)
+        munmap(data->write_ring.load(), data->write_ring_size);
+    for (const auto &[mapping, size] : data->retired_rings)
+        munmap(mapping, size);
+
+    free(data->read_frame);
+    delete data;
+
+    free(const_cast<char *>(device->uid));
+    free(const_cast<char *>(device->name));
+    free(device);
+    *p = nullptr;
+
+    return facade_error_none;
+}
+
+facade_error_code facade_create_device(facade_device_info *options)
+{
+    if (options->uid != nullptr || !valid_options(options))
+        return facade_error_invalid_input;
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    {
+        registry_lock lock;
+        registry_entry *entry = nullptr;
+
+        for (auto &candidate : shared_registry->devices)
+        {
+            if (!candidate.in_use)
+            {
+                entry = &candidate;
+                break;
+            }
+        }
+
+        if (entry == nullptr)
+        {
+            log_error("facade_create_device - Too many devices (%i)", MAX_DEVICES);
+            return facade_error_unknown;
+        }
+
+        std::snprintf(entry->uid, sizeof(entry->uid), "%s", generate_uid().c_str());
+        write_entry(*entry, options);
+        entry->in_use = 1;
+    }
+
+    publish_registry_change();
+    return facade_error_none;
+}
+
+facade_error_code facade_edit_device(char const *uid, facade_device_info *options)
+{
+    if (options->name != nullptr)
+        return facade_error_invalid_input;
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    {
+        registry_lock lock;
+        registry_entry *entry = find_entry(uid);
+
+        if (entry == nullptr)
+            return facade_error_not_found;
+        if (options->type != facade_device_type_video)
+            return facade_error_invalid_type;
+
+        if (options->width != 0)
+            entry->width = options->width;
+        if (options->height != 0)
+            entry->height = options->height;
+        if (options->frame_rate != 0)
+            entry->frame_rate = options->frame_rate;
+
+        entry->generation++;
+    }
+
+    publish_registry_change();
+    return facade_error_none;
+}
+
+facade_error_code facade_delete_device(char const *uid)
+{
+    if (shared_registry == nullptr)
+        return facade_error_not_initialized;
+
+    {
+        registry_lock lock;
+        registry_entry *entry = find_entry(uid);
+
+        if (entry == nullptr)
+            return facade_error_not_found;
+
+        entry->in_use = 0;
+    }
+
+    shm_unlink(ring_name(uid).c_str());
+    publish_registry_change();
+
+    return facade_error_none;
+}
+
+facade_error_code
+facade_on_device_changed(facade_device *device, facade_callback callback, void *context)
+{
+    std::lock_guard<std::mutex> lock(device->data->callback_mutex);
+    device->data->changed_callback = callback;
+    device->data->changed_context = context;
+
+    return facade_error_none;
+}
+
+facade_error_code facade_read_open(facade_device *device)
+{
+    facade_device_data *data = device->data;
+
+    if (data->reading)
+    {
+        log_error("facade_read_open %s - Input stream is already open.", device->uid);
+        return facade_error_invalid_state;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(data->callback_mutex);
+        data->read_callback = nullptr;
+        data->read_context = nullptr;
+    }
+
+    if (refresh_ring(device, data->read_ring, data->read_ring_size) != facade_error_none)
+        return facade_error_unknown;
+
+    data->last_read = 0;
+    // Sample the count here so a frame committed before the thread starts is not missed
+    data->reading = true;
+    data->read_thread = std::thread(run_reader, device, data->read_ring.load()->commits.load());
+
+    return facade_error_none;
+}
+
+facade_error_code
+facade_read_callback(facade_device *device, facade_callback callback, void *context)
+{
+    std::lock_guard<std::mutex> lock(device->data->callback_mutex);
+    device->data->read_callback = callback;
+    device->data->read_context = context;
+
+    return facade_error_none;
+}
+
+facade_error_code facade_read_frame(facade_device *device, void **buffer, size_t *buffer_size)
+{
+    facade_device_data *data = device->data;
+    void *pixels = nullptr;
+    size_t stride = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    const facade_error_code code = facade_read_acquire(device, &pixels, &stride, &width, &height);
+    if (code != facade_error_none)
+        return code;
+
+    const size_t frame_size = stride * height;
+
+    if (data->read_frame_size != frame_size)
+    {
+        free(data->read_frame);
+        data->read_frame = malloc(frame_size);
+        data->read_frame_size = frame_size;
+    }
+
+    std::memcpy(data->read_frame, pixels, frame_size);
+    facade_read_release(device, pixels);
+
+    *buffer = data->read_frame;
+    *buffer_size = frame_size;
+
+    return facade_error_none;
+}
+
+facade_error_code facade_read_acquire(facade_device *device,
+                                      void **buffer,
+                                      size_t *stride,
+                                      uint32_t *width,
+                                      uint32_t *height)
+{
+    facade_device_data *data = device->data;
+
+    if (!data->reading)
+        return facade_error_reader_not_ready;
+    if (data->read_lease.data != nullptr)
+    {
+        log_error("facade_read_acquire %s - A frame is already acquired.", device->uid);
+        return facade_error_invalid_state;
+    }
+    if (refresh_ring(device, data->read_ring, data->read_ring_size) != facade_error_none)
+        return facade_error_unknown;
+
+    ring *header = data->read_ring.load();
+
+    // The writer may recycle the newest slot between choosing it and claiming it, so retry
+    for (uint32_t attempt = 0; attempt < RING_SLOTS; attempt++)
+    {
+        const uint32_t commits = header->commits.load();
+        if (commits == 0 || commits == data->last_read)
+            return facade_error_reader_not_ready;
+
+        // Slots are not filled in order, so the newest frame is found by its sequence
+        uint32_t index = 0;
+        while (index < RING_SLOTS && header->slots[index].sequence.load() != commits)
+            index++;
+        if (index == RING_SLOTS)
+            continue;
+
+        ring_slot &slot = header->slots[index];
+        const int reader = claim_slot(slot);
+
+        if (reader < 0)
+        {
+            log_error("facade_read_acquire %s - The frame has too many readers.", device->uid);
+            return facade_error_reader_not_ready;
+        }
+        if (slot.sequence.load() != commits)
+        {
+            release_slot(header, slot, reader);
+            continue;
+        }
+
+        data->last_read = commits;
+        data->read_lease = {header,
+                            index,
+                            commits,
+                            header->width,
+                            header->height,
+                            slot_data(header, index),
+                            0,
+                            reader};
+        *buffer = data->read_lease.data;
+        *stride = static_cast<size_t>(BYTES_PER_PIXEL) * header->width;
+        *width = header->width;
+        *height = header->height;
+
+        return facade_error_none;
+    }
+
+    return facade_error_reader_not_ready;
+}
+
+facade_error_code facade_read_release(facade_device *device, void *buffer)
+{
+    slot_lease &lease = device->data->read_lease;
+
+    if (lease.data == nullptr || lease.data != buffer)
+    {
+        log_error("facade_read_release %s - The buffer was not acquired.", device->uid);
+        return facade_error_invalid_input;
+    }
+
+    release_slot(lease.header, lease.header->slots[lease.index], lease.reader);
+    lease = {};
+
+    return facade_error_none;
+}
+
+facade_error_code facade_read_close(facade_device *device)
+{
+    facade_device_data *data = device->data;
+
+    if (!data->reading)
+        return facade_error_none;
+
+    if (data->read_lease.data != nullptr)
+        facade_read_release(device, data->read_lease.data);
+
+    data->reading = false;
+    futex_wake(&data->read_ring.load()->commits);
+    data->read_thread.join();
+
+    return facade_error_none;
+}
+
+facade_error_code facade_write_open(facade_device *device)
+{
+    facade_device_data *data = device->data;
+
+    if (data->writing)
+    {
+        log_error("facade_write_open %s - Output stream is already open.", device->uid);
+        return facade_error_invalid_state;
+    }
+
+    if (refresh_ring(device, data->write_ring, data->write_ring_size) != facade_error_none)
+        return facade_error_unknown;
+
+    // Only one process writes a device at a time, unless the last writer died without closing
+    ring *header = data->write_ring.load();
+    int32_t writer = 0;
+
+    while (!header->writer_pid.compare_exchange_strong(writer, getpid()))
+    {
+        if (kill(writer, 0) == 0 || errno != ESRCH)
+        {
+            log_error("facade_write_open %s - Output stream is open in process %i.",
+                      device->uid,
+                      writer);
+            return facade_error_invalid_state;
+        }
+    }
+
+    data->writing = true;
+    data->write_damage.clear();
+    data->write_thread = std::thread(run_writer, device, header->commits.load());
+
+    return facade_error_none;
+}
+
+facade_error_code
+facade_write_callback(facade_device *device, facade_callback callback, void *context)
+{
+    std::lock_guard<std::mutex> lock(device->data->callback_mutex);
+    device->data->write_callback = callback;
+    device->data->write_context = context;
+
+    return facade_error_none;
+}
+
+facade_error_code facade_write_frame(facade_device *device, void *buffer, size_t buffer_size)
+{
+    facade_device_data *data = device->data;
+    const size_t frame_size = static_cast<size_t>(BYTES_PER_PIXEL) * device->width * device->height;
+
+    if (!data->writing)
+    {
+        log_error("facade_write_frame %s - Output stream was not opened.", device->uid);
+        return facade_error_writer_not_ready;
+    }
+    if (buffer_size < frame_size)
+    {
+        log_error("facade_write_frame %s - Send buffer has wrong size. (%zu vs %zu)",
+                  device->uid,
+                  buffer_size,
+                  frame_size);
+        return facade_error_invalid_input;
+    }
+
+    void *pixels = nullptr;
+    size_t stride = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    const facade_error_code code = facade_write_acquire(device, &pixels, &stride, &width, &height);
+    if (code != facade_error_none)
+        return code;
+
+    // The device may have been resized since the caller sized its buffer
+    std::memcpy(pixels, buffer, std::min(frame_size, stride * height));
+
+    return facade_write_commit(device, pixels, 0);
+}
+
+facade_error_code facade_write_damaged_frame(facade_device *device,
+                                             void *buffer,
+                                             size_t buffer_size,
+                                             const facade_rect *rects,
+                                             size_t rect_count)
+{
+    facade_device_data *data = device->data;
+    const size_t frame_stride = static_cast<size_t>(BYTES_PER_PIXEL) * device->width;
+    const size_t frame_size = frame_stride * device->height;
+
+    if (!data->writing)
+    {
+        log_error("facade_write_damaged_frame %s - Output stream was not opened.", device->uid);
+        return facade_error_writer_not_ready;
+    }
+    if (buffer_size < frame_size)
+    {
+        log_error("facade_write_damaged_frame %s - Send buffer has wrong size. (%zu vs %zu)",
+                  device->uid,
+                  buffer_size,
+                  frame_size);
+        return facade_error_invalid_input;
+    }
+
+    const std::vector<facade_rect> damage(rects, rects + rect_count);
+
+    for (const facade_rect &rect : damage)
+    {
+        if (rect.x > device->width || rect.width > device->width - rect.x ||
+            rect.y > device->height || rect.height > device->height - rect.y)
+        {
+            log_error("facade_write_damaged_frame %s - Rectangle %ux%u at (%u, %u) is outside "
+                      "the frame.",
+                      device->uid,
+                      rect.width,
+                      rect.height,
+                      rect.x,
+                      rect.y);
+            return facade_error_invalid_input;
+        }
+    }
+
+    void *pixels = nullptr;
+    size_t stride = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    const facade_error_code code = facade_write_acquire(device, &pixels, &stride, &width, &height);
+    if (code != facade_error_none)
+        return code;
+
+    const auto *source = static_cast<const uint8_t *>(buffer);
+    auto *target = static_cast<uint8_t *>(pixels);
+    std::optional<std::vector<facade_rect>> copied;
+
+    // The slot holds a frame from a few commits back, so it also takes what changed since then
+    if (width == device->width && height == device->height)
+        copied = catch_up(data, damage);
+
+    if (copied)
+    {
+        for (const facade_rect &rect : *copied)
+            for (uint32_t row = rect.y; row < rect.y + rect.height; row++)
+                std::memcpy(target + row * stride + rect.x * BYTES_PER_PIXEL,
+                            source + row * frame_stride + rect.x * BYTES_PER_PIXEL,
+                            static_cast<size_t>(rect.width) * BYTES_PER_PIXEL);
+    }
+    else
+    {
+        // The device may have been resized since the caller sized its buffer
+        std::memcpy(target, source, std::min(frame_size, stride * height));
+    }
+
+    return commit_frame(device, pixels, 0, &damage);
+}
+
+facade_error_code facade_write_acquire(facade_device *device,
+                                       void **buffer,
+                                       size_t *stride,
+                                       uint32_t *width,
+                                       uint32_t *height)
+{
+    facade_device_data *data = device->data;
+
+    if (!data->writing)
+    {
+        log_error("facade_write_acquire %s - Output stream was not opened.", device->uid);
+        return facade_error_writer_not_ready;
+    }
+    if (data->write_lease.data != nullptr)
+    {
+        log_error("facade_write_acquire %s - A buffer is already acquired.", device->uid);
+        return facade_error_invalid_state;
+    }
+    if (refresh_ring(device, data->write_ring, data->write_ring_size) != facade_error_none)
+        return facade_error_unknown;
+
+    ring *header = data->write_ring.load();
+    const uint32_t commits = header->commits.load();
+
+    // A reader may claim the chosen slot before it is invalidated, so another one is tried
+    for (uint32_t attempt = 0; attempt < RING_SLOTS; attempt++)
+    {
+        const int chosen = next_write_slot(header);
+        if (chosen < 0)
+            break;
+
+        const auto index = static_cast<uint32_t>(chosen);
+        ring_slot &slot = header->slots[index];
+
+        // Invalidate the slot before checking for readers again, so a reader that claims it from
+        // here on sees the invalid sequence and backs off
+        const uint32_t previous = slot.sequence.exchange(0);
+        if (!slot_unread(slot))
+        {
+            slot.sequence.store(previous);
+            continue;
+        }
+
+        data->write_lease = {header,
+                             index,
+                             commits + 1,
+                             header->width,
+                             header->height,
+                             slot_data(header, index),
+                             previous};
+        *buffer = data->write_lease.data;
+        *stride = static_cast<size_t>(BYTES_PER_PIXEL) * header->width;
+        *width = header->width;
+        *height = header->height;
+
+        return facade_error_none;
+    }
+
+    return facade_error_writer_not_ready;
+}
+
+facade_error_code facade_write_commit(facade_device *device, void *buffer, uint64_t timestamp)
+{
+    return commit_frame(device, buffer, timestamp, nullptr);
+}
+
+facade_error_code facade_write_close(facade_device *device)
+{
+    facade_device_data *data = device->data;
+
+    if (!data->writing)
+        return facade_error_none;
+
+    ring *header = data->write_ring.load();
+    data->write_lease = {};
+    data->write_damage.clear();
+    data->writing = false;
+    futex_wake(&header->commits);
+    futex_wake(&header->releases);
+    data->write_thread.join();
+
+    int32_t writer = getpid();
+    header->writer_pid.compare_exchange_strong(writer, 0);
+
+    return facade_error_none;
+}
@@ -0,0 +1,246 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "facade.h"
+
+namespace
+{
+
+/** More writes than the ring has slots, so damaged writes land on slots holding older frames. */
+constexpr int DAMAGED_WRITES = 10;
+/** Enough readers dying mid-read to hold every slot but the one with the newest frame. */
+constexpr int DEAD_READERS = 3;
+
+int failures = 0;
+
+void check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+std::vector<uint8_t> pattern(uint32_t width, uint32_t height, uint8_t seed)
+{
+    std::vector<uint8_t> pixels(static_cast<size_t>(BYTES_PER_PIXEL) * width * height);
+
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = static_cast<uint8_t>(i * 7 + seed);
+
+    return pixels;
+}
+
+bool read_matches(facade_device *reader, const std::vector<uint8_t> &expected)
+{
+    void *buffer = nullptr;
+    size_t buffer_size = 0;
+
+    return facade_read_frame(reader, &buffer, &buffer_size) == facade_error_none &&
+           buffer_size == expected.size() &&
+           std::memcmp(buffer, expected.data(), expected.size()) == 0;
+}
+
+/** What a device-changed callback saw when it looked its device up again. */
+struct lookup
+{
+    const char *uid;
+    std::atomic<bool> done{false};
+    bool found = false;
+};
+
+/** Finds and disposes of the changed device from inside its callback, as the CLI does. */
+void look_up_changed_device(void *context)
+{
+    auto *result = static_cast<lookup *>(context);
+    facade_device *device = nullptr;
+
+    result->found = facade_find_device_by_uid(result->uid, &device) == facade_error_none;
+    if (device != nullptr)
+        facade_dispose_device(&device);
+
+    result->done = true;
+}
+
+bool wait_for(const std::atomic<bool> &flag)
+{
+    for (int attempt = 0; attempt < 200 && !flag; attempt++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    return flag;
+}
+
+/** Acquire the newest frame in a child process that exits without releasing it. */
+bool acquire_and_die(facade_device *reader)
+{
+    const pid_t child = fork();
+
+    if (child == 0)
+    {
+        void *pixels = nullptr;
+        size_t stride = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+
+        _exit(facade_read_acquire(reader, &pixels, &stride, &width, &height) == facade_error_none
+                  ? 0
+                  : 1);
+    }
+
+    int status = 0;
+    return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+           WEXITSTATUS(status) == 0;
+}
+
+bool write_frames(facade_device *writer, std::vector<uint8_t> &frame, int count)
+{
+    for (int i = 0; i < count; i++)
+        if (facade_write_frame(writer, frame.data(), frame.size()) != facade_error_none)
+            return false;
+
+    return true;
+}
+
+/** Devices learn of edits from the registry listener, so wait for it to catch up. */
+bool wait_for_size(facade_device *device, uint32_t width, uint32_t height)
+{
+    for (int attempt = 0; attempt < 200; attempt++)
+    {
+        if (device->width == width && device->height == height)
+            return true;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return false;
+}
+
+} // namespace
+
+int main()
+{
+    const std::string name = "facade-test-" + std::to_string(getpid());
+
+    if (facade_init() != facade_error_none)
+    {
+        std::fprintf(stderr, "FAILED: facade_init\n");
+        return 1;
+    }
+
+    facade_device_info info{};
+    info.type = facade_device_type_video;
+    info.name = name.c_str();
+    info.width = 64;
+    info.height = 48;
+    info.frame_rate = 30;
+
+    facade_device *writer = nullptr;
+    facade_device *reader = nullptr;
+
+    check(facade_create_device(&info) == facade_error_none, "create the device");
+    check(facade_find_device_by_name(name.c_str(), &writer) == facade_error_none,
+          "find the writer");
+    check(facade_find_device_by_name(name.c_str(), &reader) == facade_error_none,
+          "find the reader");
+    if (writer == nullptr || reader == nullptr)
+        return 1;
+
+    check(facade_write_open(writer) == facade_error_none, "open for writing");
+    check(facade_read_open(reader) == facade_error_none, "open for reading");
+
+    std::vector<uint8_t> frame = pattern(64, 48, 1);
+    check(facade_write_frame(writer, frame.data(), frame.size()) == facade_error_none,
+          "write a full frame");
+    check(read_matches(reader, frame), "read back a full frame");
+
+    for (int i = 0; i < DAMAGED_WRITES; i++)
+    {
+        const facade_rect rect = {
+            static_cast<uint32_t>(i * 5), static_cast<uint32_t>(i * 3), 8, 4};
+
+        for (uint32_t row = rect.y; row < rect.y + rect.height; row++)
+            std::memset(frame.data() + (row * 64 + rect.x) * BYTES_PER_PIXEL,
+                        0x40 + i,
+                        rect.width * BYTES_PER_PIXEL);
+
+        check(facade_write_damaged_frame(writer, frame.data(), frame.size(), &rect, 1) ==
+                  facade_error_none,
+              "write a damaged frame");
+        check(read_matches(reader, frame), "read back a damaged frame");
+    }
+
+    const facade_rect outside = {60, 0, 8, 1};
+    check(facade_write_damaged_frame(writer, frame.data(), frame.size(), &outside, 1) ==
+              facade_error_invalid_input,
+          "reject a damaged rectangle outside the frame");
+
+    for (int i = 0; i < DEAD_READERS; i++)
+    {
+        check(write_frames(writer, frame, 1), "write a frame for a reader to hold");
+        check(acquire_and_die(reader), "acquire a frame in a reader that dies");
+    }
+    check(write_frames(writer, frame, DAMAGED_WRITES), "write past readers that died");
+
+    void *held = nullptr;
+    size_t held_stride = 0;
+    uint32_t held_width = 0;
+    uint32_t held_height = 0;
+
+    check(facade_read_acquire(reader, &held, &held_stride, &held_width, &held_height) ==
+              facade_error_none,
+          "acquire a frame to hold");
+    check(write_frames(writer, frame, DAMAGED_WRITES), "write past a held frame");
+    check(facade_read_release(reader, held) == facade_error_none, "release the held frame");
+
+    facade_device_info resize{};
+    resize.type = facade_device_type_video;
+    resize.width = 128;
+    resize.height = 96;
+
+    lookup changed_lookup{.uid = writer->uid};
+    facade_on_device_changed(writer, look_up_changed_device, &changed_lookup);
+
+    check(facade_edit_device(writer->uid, &resize) == facade_error_none, "resize the device");
+    check(wait_for_size(writer, 128, 96), "see the new size on the writer");
+    check(wait_for(changed_lookup.done) && changed_lookup.found,
+          "find the device from its changed callback");
+    facade_on_device_changed(writer, nullptr, nullptr);
+
+    frame = pattern(128, 96, 2);
+    check(facade_write_frame(writer, frame.data(), frame.size()) == facade_error_none,
+          "write a resized frame");
+
+    void *pixels = nullptr;
+    size_t stride = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    check(facade_read_acquire(reader, &pixels, &stride, &width, &height) == facade_error_none,
+          "acquire a resized frame");
+    check(width == 128 && height == 96 && stride == 128 * BYTES_PER_PIXEL,
+          "acquire the resized frame's size");
+    check(pixels != nullptr && std::memcmp(pixels, frame.data(), frame.size()) == 0,
+          "read back a resized frame");
+    check(facade_read_release(reader, pixels) == facade_error_none, "release the frame");
+
+    check(facade_read_close(reader) == facade_error_none, "close for reading");
+    check(facade_write_close(writer) == facade_error_none, "close for writing");
+    check(facade_delete_device(writer->uid) == facade_error_none, "delete the device");
+
+    facade_device *deleted = nullptr;
+    check(facade_find_device_by_name(name.c_str(), &deleted) == facade_error_not_found,
+          "forget the deleted device");
+
+    facade_dispose_device(&reader);
+    facade_dispose_device(&writer);
+
+    return failures == 0 ? 0 : 1;
+}